@@ -0,0 +1,187 @@
+/*!
+    \file
+    \brief Пул памяти PSRAM для буферов.
+    \authors Близнец Р.А. (r.bliznets@gmail.com)
+    \version 0.1.0.0
+    \date 17.10.2026
+*/
+
+#include "CBufferPool.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include <cstring>
+#include <cinttypes>
+
+static const char *TAG = "pool";
+
+uint8_t *CBufferPool::mPool = nullptr;
+uint32_t CBufferPool::mSize = 0;
+uint8_t *CBufferPool::mState = nullptr;
+CBufferPool::SFree *CBufferPool::mFree[POOL_ORDERS] = {};
+uint32_t CBufferPool::mUsed = 0;
+std::mutex CBufferPool::mMutex;
+
+void CBufferPool::push(uint32_t block, uint8_t order)
+{
+    SFree *f = (SFree *)&mPool[block * POOL_MIN_BLOCK];
+    f->prev = nullptr;
+    f->next = mFree[order];
+    if (f->next != nullptr)
+        f->next->prev = f;
+    mFree[order] = f;
+    mState[block] = order | 0x80;
+}
+
+void CBufferPool::remove(uint32_t block, uint8_t order)
+{
+    SFree *f = (SFree *)&mPool[block * POOL_MIN_BLOCK];
+    if (f->prev != nullptr)
+        f->prev->next = f->next;
+    else
+        mFree[order] = f->next;
+    if (f->next != nullptr)
+        f->next->prev = f->prev;
+    mState[block] = 0xff;
+}
+
+void CBufferPool::clear()
+{
+    heap_caps_free(mPool);
+    mPool = nullptr;
+    delete[] mState;
+    mState = nullptr;
+    std::memset(mFree, 0, sizeof(mFree));
+    mSize = 0;
+}
+
+bool CBufferPool::init(uint32_t size)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mPool != nullptr)
+    {
+        if (mUsed != 0)
+        {
+            ESP_LOGE(TAG, "Pool has %" PRIu32 " bytes in use", mUsed);
+            return false;
+        }
+        clear();
+    }
+    size -= size % POOL_MIN_BLOCK;
+    if (size == 0)
+        return false;
+#ifdef CONFIG_SPIRAM
+    mPool = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+#else
+    mPool = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+#endif
+    if (mPool == nullptr)
+    {
+        ESP_LOGE(TAG, "Failed to reserve pool %" PRIu32, size);
+        return false;
+    }
+    uint32_t blocks = size / POOL_MIN_BLOCK;
+    mState = new uint8_t[blocks];
+    std::memset(mState, 0xff, blocks);
+    mSize = size;
+    mUsed = 0;
+
+    // Пул делится на блоки максимального размера по убыванию, каждый выровнен на свой размер.
+    uint32_t block = 0;
+    for (int order = POOL_ORDERS - 1; order >= 0; order--)
+    {
+        if ((blocks - block) >= (1UL << order))
+        {
+            push(block, order);
+            block += (1UL << order);
+        }
+    }
+    ESP_LOGI(TAG, "Pool was reserved %" PRIu32, size);
+    return true;
+}
+
+void CBufferPool::free()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mPool == nullptr)
+        return;
+    if (mUsed != 0)
+    {
+        // Выделенные блоки остаются действительными, пул не освобождается.
+        ESP_LOGE(TAG, "Pool has %" PRIu32 " bytes in use", mUsed);
+        return;
+    }
+    clear();
+}
+
+uint8_t *CBufferPool::alloc(uint32_t size)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if ((mPool == nullptr) || (size == 0))
+        return nullptr;
+    uint8_t order = 0;
+    while ((order < POOL_ORDERS) && ((uint32_t)(POOL_MIN_BLOCK << order) < size))
+        order++;
+    uint8_t k = order;
+    while ((k < POOL_ORDERS) && (mFree[k] == nullptr))
+        k++;
+    if (k >= POOL_ORDERS)
+        return nullptr;
+
+    uint32_t block = ((uint8_t *)mFree[k] - mPool) / POOL_MIN_BLOCK;
+    remove(block, k);
+    // Лишняя половина блока возвращается в список свободных, пока размер не станет нужным.
+    while (k > order)
+    {
+        k--;
+        push(block + (1UL << k), k);
+    }
+    mState[block] = order;
+    mUsed += POOL_MIN_BLOCK << order;
+    return &mPool[block * POOL_MIN_BLOCK];
+}
+
+bool CBufferPool::release(uint8_t *ptr)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if ((mPool == nullptr) || (ptr < mPool) || (ptr >= &mPool[mSize]))
+        return false;
+    uint32_t block = (ptr - mPool) / POOL_MIN_BLOCK;
+    uint8_t order = mState[block];
+    if (order >= POOL_ORDERS)
+    {
+        ESP_LOGE(TAG, "Wrong block %p", ptr);
+        return true;
+    }
+    mState[block] = 0xff;
+    mUsed -= POOL_MIN_BLOCK << order;
+
+    // Объединение со свободным близнецом того же размера.
+    uint32_t blocks = mSize / POOL_MIN_BLOCK;
+    while (order < (POOL_ORDERS - 1))
+    {
+        uint32_t buddy = block ^ (1UL << order);
+        if ((buddy >= blocks) || (mState[buddy] != (order | 0x80)))
+            break;
+        remove(buddy, order);
+        block &= ~(1UL << order);
+        order++;
+    }
+    push(block, order);
+    return true;
+}
+
+uint8_t CBufferPool::stats(uint32_t &free, uint32_t &largest)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    free = mSize - mUsed;
+    largest = 0;
+    for (int order = POOL_ORDERS - 1; order >= 0; order--)
+    {
+        if (mFree[order] != nullptr)
+        {
+            largest = POOL_MIN_BLOCK << order;
+            break;
+        }
+    }
+    return (free == 0) ? 0 : (100 - (uint64_t)largest * 100 / free);
+}
@@ -0,0 +1,91 @@
+/*!
+    \file
+    \brief Приёмники данных буфера PSRAM.
+    \authors Близнец Р.А. (r.bliznets@gmail.com)
+    \version 0.1.0.0
+    \date 17.10.2026
+*/
+
+#include "CBufferSink.h"
+#include "CSpiffsSystem.h"
+#include "esp_log.h"
+#include <cinttypes>
+
+static const char *TAG = "sink";
+
+bool CFileSink::open(uint32_t size)
+{
+    cancel();
+    std::string str = CSpiffsSystem::path(mFileName + '$');
+    mFile = std::fopen(str.c_str(), "w");
+    if (mFile == nullptr)
+    {
+        ESP_LOGW(TAG, "Failed to open file %s", str.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool CFileSink::write(const uint8_t *data, uint32_t size)
+{
+    return (mFile != nullptr) && (std::fwrite(data, 1, size, mFile) == size);
+}
+
+bool CFileSink::commit()
+{
+    if (mFile == nullptr)
+        return false;
+    bool res = (std::fclose(mFile) == 0);
+    mFile = nullptr;
+    if (res)
+        res = CSpiffsSystem::commitFile(mFileName);
+    if (!res)
+        ESP_LOGW(TAG, "Failed to commit file %s", mFileName.c_str());
+    return res;
+}
+
+void CFileSink::cancel()
+{
+    if (mFile != nullptr)
+    {
+        std::fclose(mFile);
+        mFile = nullptr;
+        std::remove(CSpiffsSystem::path(mFileName + '$').c_str());
+    }
+}
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+bool CPartitionSink::open(uint32_t size)
+{
+    mPos = 0;
+    mPartition = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, mLabel.c_str());
+    if (mPartition == nullptr)
+    {
+        ESP_LOGW(TAG, "Failed to find partition %s", mLabel.c_str());
+        return false;
+    }
+    uint32_t sz = (size + mPartition->erase_size - 1) / mPartition->erase_size * mPartition->erase_size;
+    if (((mOffset % mPartition->erase_size) != 0) || ((mOffset + sz) > mPartition->size))
+    {
+        ESP_LOGW(TAG, "Wrong region %" PRIu32 "(%" PRIu32 ") of partition %s", mOffset, sz, mLabel.c_str());
+        mPartition = nullptr;
+        return false;
+    }
+    esp_err_t err = esp_partition_erase_range(mPartition, mOffset, sz);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to erase partition %s (%s)", mLabel.c_str(), esp_err_to_name(err));
+        mPartition = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool CPartitionSink::write(const uint8_t *data, uint32_t size)
+{
+    if ((mPartition == nullptr) || (esp_partition_write(mPartition, mOffset + mPos, data, size) != ESP_OK))
+        return false;
+    mPos += size;
+    return true;
+}
+#endif
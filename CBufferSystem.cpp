@@ -7,19 +7,62 @@
 */
 
 #include "CBufferSystem.h"
+#include "CSpiffsSystem.h"
+#include "CBufferPool.h"
 #include "esp_log.h"
 #include "esp_heap_caps.h"
+#include "freertos/task.h"
+#include "esp_rom_crc.h"
+#include <dirent.h>
+#include <algorithm>
+#include <cinttypes>
 
 static const char *TAG = "buf";
 
+/// Выделить память из пула, либо из кучи, если пул не зарезервирован.
+static uint8_t *buf_alloc(uint32_t size)
+{
+    if (CBufferPool::isInit())
+        return CBufferPool::alloc(size);
+    return (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+}
+
+/// Освободить память, выделенную buf_alloc.
+static void buf_free(uint8_t *ptr)
+{
+    if (!CBufferPool::release(ptr))
+        heap_caps_free(ptr);
+}
+
+/// Статистика пула для ответа check.
+static std::string pool_stats()
+{
+    if (!CBufferPool::isInit())
+        return "";
+    uint32_t free;
+    uint32_t largest;
+    uint8_t frag = CBufferPool::stats(free, largest);
+    return ",\"pool\":{\"free\":" + std::to_string(free) + ",\"largest\":" + std::to_string(largest) + ",\"frag\":" + std::to_string(frag) + "}";
+}
+
+/// Поле есть в объекте команды (значение любого типа, в том числе пустой массив).
+static bool has_field(CJsonParser *cmd, int beg, const std::string &name)
+{
+    std::string key;
+    for (auto [k, v] : cmd->members(beg))
+    {
+        if (cmd->getString(k, key) && (key == name))
+            return true;
+    }
+    return false;
+}
+
 bool CBufferSystem::init(uint32_t size)
 {
     free();
-#ifdef CONFIG_SPIRAM
-    mBuffer = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
-#else
-    mBuffer = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
-#endif
+    mStats = {};
+    mStats.start = xTaskGetTickCount();
+    mBuffer = buf_alloc(size);
     if (mBuffer != nullptr)
     {
         mSize = size;
@@ -31,9 +74,29 @@ bool CBufferSystem::init(uint32_t size)
 
 void CBufferSystem::free()
 {
+    std::lock_guard<std::mutex> lock(mRingMutex);
+    if (mSink)
+    {
+        mSink->cancel();
+        mSink.reset();
+    }
+    mSinkError.clear();
+    mRing = false;
+    mRead = false;
+    mReceived = 0;
+    mContiguous = 0;
+    mQueued = 0;
+    mQueuePos = 0;
+    mFec = 0;
+    mGroups = 0;
+    if (mParity != nullptr)
+    {
+        buf_free(mParity);
+        mParity = nullptr;
+    }
     if (mBuffer != nullptr)
     {
-        heap_caps_free(mBuffer);
+        buf_free(mBuffer);
         mBuffer = nullptr;
         if (mParts != nullptr)
         {
@@ -43,40 +106,89 @@ void CBufferSystem::free()
     }
 }
 
-std::string CBufferSystem::command(CJsonParser *cmd, bool& cancel)
+std::string CBufferSystem::command(CJsonParser *cmd, bool& cancel, int beg)
 {
     std::string answer = "";
     int t2;
     int x;
     cancel = false;
-    if (cmd->getObject(1, "buf", t2))
+    if (cmd->getObject(beg, "buf", t2))
     {
         std::string fname;
+        int part = BUF_PART_SIZE;
+        int fec = 0;
+        int progress = 0;
         answer = "\"buf\":{";
 
-        if (cmd->getInt(t2, "create", x))
+        if ((cmd->getMany(t2, {{"create", &x}, {"part", &part}, {"fec", &fec}, {"progress", &progress}}) & 0x01) != 0)
         {
-            if (init(x))
+            std::string sink;
+            int offset = 0;
+            uint32_t mask = cmd->getMany(t2, {{"sink", &sink}, {"partition", &sink}, {"offset", &offset}});
+            if (init(x) && split(part, fec, 0))
             {
-                if (cmd->getInt(t2, "part", x))
-                    mPart = x;
-                else
-                    mPart = BUF_PART_SIZE;
-                mLastPart = mSize / mPart;
-                if (mSize % mPart == 0)
-                    mLastPart--;
-                mParts = new uint8_t[mLastPart + 1];
-                std::memset(mParts, 0, mLastPart + 1);
                 mRead = false;
-                answer += "\"ok\":\"Buf was created " + std::to_string(mSize) + "(" + std::to_string(mPart) + ")" + "\"";
+                mNotifyStep = ((progress < 0) || (progress > 100)) ? 100 : progress;
+                if ((mask & 0x01) != 0)
+                    mSink.reset(new CFileSink(sink));
+#ifndef CONFIG_IDF_TARGET_LINUX
+                else if ((mask & 0x02) != 0)
+                    mSink.reset(new CPartitionSink(sink, offset));
+#endif
+                else
+                    mSink = std::move(mNextSink);
+                mFlushed = 0;
+                if (mSink && !mSink->open(mSize))
+                {
+                    answer += "\"error\":\"Sink " + mSink->name() + " wasn't opened\"";
+                    mSink.reset();
+                    free();
+                }
+                else
+                {
+                    answer += "\"ok\":\"Buf was created " + std::to_string(mSize) + "(" + std::to_string(mPart) + ")" + "\"";
+                    if (mFec != 0)
+                        answer += ",\"fec\":" + std::to_string(mFec) + ",\"parity\":" + std::to_string(mLastPart + 1);
+                    if (mSink)
+                        answer += ",\"sink\":\"" + mSink->name() + "\"";
+                }
             }
             else
             {
                 answer += "\"error\":\"Buf wasn't created " + std::to_string(x) + "\"";
             }
         }
+        else if ((cmd->getMany(t2, {{"ring", &x}, {"part", &part}}) & 0x01) != 0)
+        {
+            if (ring(x, part))
+            {
+                answer += "\"ok\":\"Ring was created " + std::to_string(mSize) + "(" + std::to_string(mPart) + ")" + "\"";
+            }
+            else
+            {
+                answer += "\"error\":\"Ring wasn't created " + std::to_string(x) + "\"";
+            }
+        }
+        else if (cmd->getField(t2, "stats"))
+        {
+            uint32_t ms = ((mStats.time != 0) ? mStats.time : (xTaskGetTickCount() - mStats.start)) * portTICK_PERIOD_MS;
+            uint32_t mem = (mBuffer == nullptr) ? 0 : (mSize + ((mParts == nullptr) ? 0 : (mLastPart + 1 + mGroups)) + mGroups * mPart);
+            answer += "\"stats\":{\"parts\":" + std::to_string(mStats.parts) + ",\"bytes\":" + std::to_string(mStats.bytes);
+            answer += ",\"dup\":" + std::to_string(mStats.duplicates) + ",\"errors\":" + std::to_string(mStats.errors);
+            answer += ",\"checks\":" + std::to_string(mStats.checks) + ",\"ms\":" + std::to_string(ms);
+            if ((mStats.time != 0) && (ms != 0))
+                answer += ",\"rate\":" + std::to_string((uint64_t)mSize * 1000 / ms);
+            answer += ",\"mem\":" + std::to_string(mem) + "}";
+        }
+        else if (cmd->getField(t2, "check") && mRing)
+        {
+            answer += "\"ring\":" + std::to_string(mUsed) + ",\"seq\":" + std::to_string(mSeq) + ",\"overrun\":" + std::to_string(mOverrun);
+            answer += ",\"size\":" + std::to_string(mSize) + ",\"part\":" + std::to_string(mPart);
+            answer += pool_stats();
+        }
         else if (cmd->getField(t2, "check"))
         {
+            mStats.checks++;
             if (mParts == nullptr)
             {
                 answer += "\"error\":\"Buf wasn't created\"";
@@ -98,6 +210,15 @@ std::string CBufferSystem::command(CJsonParser *cmd, bool& cancel)
                 }
                 answer += "]";
                 answer += ",\"size\":" + std::to_string(mSize) + ",\"part\":" + std::to_string(mPart);
+                if (!mRead)
+                    answer += ",\"contiguous\":" + std::to_string(watermark()) + ",\"ooo\":" + std::to_string(outOfOrder());
+                if (mFec != 0)
+                    answer += ",\"fec\":" + std::to_string(mFec) + ",\"recovered\":" + std::to_string(mRecovered);
+                if (mSink)
+                    answer += ",\"sink\":\"" + mSink->name() + "\",\"flushed\":" + std::to_string(mFlushed);
+                else if (!mSinkError.empty())
+                    answer += ",\"sink\":\"" + mSinkError + "\"";
+                answer += pool_stats();
             }
         }
         else if (cmd->getString(t2, "wr", fname))
@@ -108,7 +229,8 @@ std::string CBufferSystem::command(CJsonParser *cmd, bool& cancel)
             }
             else
             {
-                std::string str = "/spiffs/" + fname;
+                std::string str = CSpiffsSystem::path(fname);
+                CSpiffsSystem::invalidate(fname);
                 FILE *f = std::fopen(str.c_str(), "a");
                 if (f == nullptr)
                 {
@@ -119,7 +241,7 @@ std::string CBufferSystem::command(CJsonParser *cmd, bool& cancel)
                 {
                     if (std::fwrite(mBuffer, 1, mSize, f) != mSize)
                     {
-                        ESP_LOGE(TAG, "Failed to write to file %s(%ld)", fname.c_str(), mSize);
+                        ESP_LOGE(TAG, "Failed to write to file %s(%" PRIu32 ")", fname.c_str(), mSize);
                         answer += "\"error\":\"Failed to write to file " + fname + "\"";
                     }
                     else
@@ -132,9 +254,107 @@ std::string CBufferSystem::command(CJsonParser *cmd, bool& cancel)
                 }
             }
         }
+        else if (cmd->getArray(t2, "get", x))
+        {
+            if (!mRead || mRing || (mParts == nullptr))
+            {
+                answer += "\"error\":\"Buf wasn't loaded\"";
+            }
+            else
+            {
+                if (cmd->getField(t2, "only"))
+                {
+                    std::memset(mParts, 0, mLastPart + 1 + mGroups);
+                    mQueued = 0;
+                }
+                int range;
+                for (int i : cmd->elements(x))
+                {
+                    // Номер пакета, либо диапазон [первый,последний].
+                    int a = -1;
+                    int b = -1;
+                    if (cmd->getInt(i, a))
+                        b = a;
+                    else if (cmd->getArray(i, range))
+                    {
+                        int k = 0;
+                        for (int j : cmd->elements(range))
+                        {
+                            if (k++ == 0)
+                                cmd->getInt(j, a);
+                            else
+                                cmd->getInt(j, b);
+                        }
+                        // Диапазон из одного номера [первый] - один пакет.
+                        if (k == 1)
+                            b = a;
+                    }
+                    if ((a < 0) || (b < a) || (a > (mLastPart + mGroups)))
+                        continue;
+                    // Очередь - отметки в mParts, повторный запрос пакета её не увеличивает.
+                    mQueuePos = std::min<uint32_t>(mQueuePos, a);
+                    for (int j = a; (j <= b) && (j <= (mLastPart + mGroups)); j++)
+                    {
+                        if (mParts[j] != BUF_PART_QUEUED)
+                        {
+                            mParts[j] = BUF_PART_QUEUED;
+                            mQueued++;
+                        }
+                    }
+                }
+                answer += "\"queued\":" + std::to_string(mQueued);
+            }
+        }
+        else if (cmd->getString(t2, "delta", fname))
+        {
+            if ((mBuffer == nullptr) || mRead || mRing)
+            {
+                answer += "\"error\":\"Buf wasn't created\"";
+            }
+            else
+            {
+                int block = 1024;
+                cmd->getInt(t2, "block", block);
+                answer += delta(fname, block);
+                if (cmd->getField(t2, "free"))
+                    free();
+            }
+        }
+        else if (cmd->getArray(t2, "rd", x) || (cmd->getString(t2, "rd", fname) && !fname.empty() && (fname.back() == '*')))
+        {
+            std::vector<std::string> names;
+            cmd->getInt(t2, "part", part);
+            cmd->getInt(t2, "fec", fec);
+            if (fname.empty())
+            {
+                for (int i : cmd->elements(x))
+                {
+                    if (cmd->getString(i, fname))
+                        names.push_back(CJsonParser::unescape(fname.data(), fname.size()));
+                }
+            }
+            else
+            {
+                fname.pop_back();
+                fname = CJsonParser::unescape(fname.data(), fname.size());
+                DIR *dp = opendir(CSpiffsSystem::base());
+                if (dp != nullptr)
+                {
+                    struct dirent *entry;
+                    while ((entry = readdir(dp)))
+                    {
+                        std::string name = entry->d_name;
+                        if ((name.compare(0, fname.size(), fname) == 0) && (name.back() != '$') && (name.back() != '!'))
+                            names.push_back(name);
+                    }
+                    closedir(dp);
+                }
+            }
+            answer += bundle(names, part, fec);
+        }
         else if (cmd->getString(t2, "rd", fname))
         {
-            std::string str = "/spiffs/" + fname;
+            std::string str = CSpiffsSystem::path(fname);
             FILE *f = std::fopen(str.c_str(), "r");
             if (f == nullptr)
             {
@@ -145,24 +365,25 @@ std::string CBufferSystem::command(CJsonParser *cmd, bool& cancel)
             {
                 answer += "\"fr\":\"" + fname + "\",";
                 std::fseek(f, 0, SEEK_END);
-                int32_t sz = std::ftell(f);
-                if (init(sz))
+                long sz = std::ftell(f);
+                cmd->getInt(t2, "part", part);
+                cmd->getInt(t2, "fec", fec);
+                if (sz < 0)
+                {
+                    answer += "\"error\":\"Failed to read file " + fname + "\"";
+                }
+                else if (init(sz))
                 {
-                    if (cmd->getInt(t2, "part", x))
-                        mPart = x;
-                    else
-                        mPart = BUF_PART_SIZE;
-                    mLastPart = mSize / mPart;
-                    if (mSize % mPart == 0)
-                        mLastPart--;
                     std::fseek(f, 0, SEEK_SET);
                     size_t sz = std::fread(mBuffer, 1, mSize, f);
-                    if (sz == mSize)
+                    if ((sz == mSize) && split(part, fec, 1))
                     {
-                        mParts = new uint8_t[mLastPart + 1];
-                        std::memset(mParts, 1, mLastPart + 1);
+                        for (uint16_t g = 0; g < mGroups; g++)
+                            parity(g, &mParity[g * mPart]);
                         answer += "\"ok\":\"buffer was loaded from " + fname + "\"";
                         answer += ",\"size\":" + std::to_string(mSize) + ",\"part\":" + std::to_string(mPart);
+                        if (mFec != 0)
+                            answer += ",\"fec\":" + std::to_string(mFec) + ",\"parity\":" + std::to_string(mLastPart + 1);
                         mRead = true;
                     }
                     else
@@ -173,11 +394,15 @@ std::string CBufferSystem::command(CJsonParser *cmd, bool& cancel)
                 }
                 else
                 {
-                    answer += "\"error\":\"Buf wasn't created " + std::to_string(x) + "\"";
+                    answer += "\"error\":\"Buf wasn't created " + std::to_string(sz) + "\"";
                 }
                 std::fclose(f);
             }
         }
+        else if (has_field(cmd, t2, "rd"))
+        {
+            answer += "\"error\":\"No files\"";
+        }
         else if (cmd->getField(t2, "free"))
         {
             if (mBuffer == nullptr)
@@ -213,18 +438,29 @@ void CBufferSystem::addData(uint8_t *data, uint32_t size)
     if ((mBuffer != nullptr) && (mParts != nullptr))
     {
         uint16_t part = data[0] + data[1] * 256;
+        mStats.parts++;
+        mStats.bytes += size - 2;
         if (part < mLastPart)
         {
-            if (size == (mPart + 2))
+            if (size == (mPart + 2U))
             {
                 std::memcpy(&mBuffer[part * mPart], &data[2], mPart);
                 if (mParts[part] != 0)
+                {
                     ESP_LOGW(TAG, "rewrite part %d", part);
+                    mStats.duplicates++;
+                }
                 else
+                {
                     mParts[part] = 1;
+                    received();
+                }
             }
             else
-                ESP_LOGE(TAG, "size %ld != %d for %d", (size - 2), mPart, part);
+            {
+                ESP_LOGE(TAG, "size %" PRIu32 " != %d for %d", (size - 2), mPart, part);
+                mStats.errors++;
+            }
         }
         else if (part == mLastPart)
         {
@@ -233,15 +469,54 @@ void CBufferSystem::addData(uint8_t *data, uint32_t size)
             {
                 std::memcpy(&mBuffer[part * mPart], &data[2], sz);
                 if (mParts[part] != 0)
+                {
                     ESP_LOGW(TAG, "rewrite part %d", part);
+                    mStats.duplicates++;
+                }
                 else
+                {
                     mParts[part] = 1;
+                    received();
+                }
             }
             else
-                ESP_LOGE(TAG, "size %ld != %ld for %d", (size - 2), sz, part);
+            {
+                ESP_LOGE(TAG, "size %" PRIu32 " != %" PRIu32 " for %d", (size - 2), sz, part);
+                mStats.errors++;
+            }
+        }
+        else if (part <= (mLastPart + mGroups))
+        {
+            if (size == (mPart + 2U))
+            {
+                if (mParts[part] != 0)
+                {
+                    ESP_LOGW(TAG, "rewrite parity %d", part);
+                    mStats.duplicates++;
+                }
+                else
+                {
+                    uint16_t g = part - mLastPart - 1;
+                    std::memcpy(&mParity[g * mPart], &data[2], mPart);
+                    mParts[part] = 1;
+                    recover(g);
+                }
+            }
+            else
+            {
+                ESP_LOGE(TAG, "size %" PRIu32 " != %d for parity %d", (size - 2), mPart, part);
+                mStats.errors++;
+            }
+            return;
         }
         else
-            ESP_LOGE(TAG, "part %d > %d", part, mPart);
+        {
+            mStats.errors++;
+            ESP_LOGE(TAG, "part %d > %d", part, mLastPart + mGroups);
+            return;
+        }
+        if (mFec != 0)
+            recover(part / mFec);
     }
     else
         ESP_LOGE(TAG, "mBuffer == null");
@@ -250,7 +525,70 @@ void CBufferSystem::addData(uint8_t *data, uint32_t size)
 uint8_t *CBufferSystem::getData(uint32_t &size, uint16_t &index)
 {
     uint8_t *res = nullptr;
-    if (mRead && (mParts != nullptr))
+    if (mRing)
+    {
+        // Пакет, выданный предыдущим вызовом, передан и его место освобождается.
+        if (mSending)
+        {
+            mSending = false;
+            mReadPos = (mReadPos + mPart) % mSize;
+            mUsed -= mPart;
+        }
+        if (mUsed >= mPart)
+        {
+            mSending = true;
+            size = mPart;
+            index = mSeq++;
+            res = &mBuffer[mReadPos];
+        }
+    }
+    else if (mRead && (mParts != nullptr) && (mQueued != 0))
+    {
+        // Запрошенные командой get пакеты передаются первыми, по возрастанию номера.
+        uint32_t n = mLastPart + 1U + mGroups;
+        while ((mQueuePos < n) && (mParts[mQueuePos] != BUF_PART_QUEUED))
+            mQueuePos++;
+        if (mQueuePos >= n)
+        {
+            mQueued = 0;
+            return getData(size, index);
+        }
+        uint16_t k = mQueuePos++;
+        mParts[k] = 0;
+        mQueued--;
+        if (k <= mLastPart)
+        {
+            size = partSize(k);
+            res = &mBuffer[k * mPart];
+        }
+        else
+        {
+            size = mPart;
+            res = &mParity[(k - mLastPart - 1) * mPart];
+        }
+        index = k;
+    }
+    else if (mRead && (mParts != nullptr) && (mFec != 0))
+    {
+        // Пакет четности передаётся сразу после пакетов своей группы.
+        for (uint16_t g = 0; (g < mGroups) && (res == nullptr); g++)
+        {
+            uint16_t last = groupLast(g);
+            for (uint32_t i = g * mFec; i <= (last + 1U); i++)
+            {
+                uint16_t k = (i <= last) ? i : (mLastPart + 1 + g);
+                if (mParts[k] == 1)
+                {
+                    mParts[k] = 0;
+                    size = (i <= last) ? partSize(i) : mPart;
+                    res = (i <= last) ? &mBuffer[i * mPart] : &mParity[g * mPart];
+                    index = k;
+                    break;
+                }
+            }
+        }
+    }
+    else if (mRead && (mParts != nullptr))
     {
         for (int i = 0; i <= mLastPart; i++)
         {
@@ -271,5 +609,424 @@ uint8_t *CBufferSystem::getData(uint32_t &size, uint16_t &index)
             }
         }
     }
+    if (res != nullptr)
+    {
+        mStats.parts++;
+        mStats.bytes += size;
+    }
+    return res;
+}
+
+bool CBufferSystem::load(const uint8_t *data, uint32_t size, uint16_t part)
+{
+    if ((size == 0) || !init(size))
+        return false;
+    std::memcpy(mBuffer, data, size);
+    if (!split(part, 0, 1))
+    {
+        free();
+        return false;
+    }
+    mRead = true;
+    return true;
+}
+
+bool CBufferSystem::ring(uint32_t size, uint16_t part)
+{
+    if ((part == 0) || (size < part) || !init(size - size % part))
+        return false;
+    std::lock_guard<std::mutex> lock(mRingMutex);
+    mPart = part;
+    mWrite = 0;
+    mReadPos = 0;
+    mUsed = 0;
+    mOverrun = 0;
+    mSending = false;
+    mSeq = 0;
+    mRead = true;
+    mRing = true;
+    return true;
+}
+
+bool CBufferSystem::push(const uint8_t *data, uint32_t size)
+{
+    std::lock_guard<std::mutex> lock(mRingMutex);
+    if (!mRing || (size > (mSize - mUsed)))
+    {
+        mOverrun++;
+        return false;
+    }
+    uint32_t sz = std::min(size, mSize - mWrite);
+    std::memcpy(&mBuffer[mWrite], data, sz);
+    if (sz < size)
+        std::memcpy(mBuffer, &data[sz], size - sz);
+    mWrite = (mWrite + size) % mSize;
+    mUsed += size;
+    return true;
+}
+
+uint8_t *CBufferSystem::reserve(uint32_t &size)
+{
+    // Мьютекс остаётся захваченным до commit.
+    mRingMutex.lock();
+    uint32_t free = mRing ? (mSize - mUsed) : 0;
+    size = std::min(size, std::min(free, mSize - mWrite));
+    if (size == 0)
+    {
+        mOverrun++;
+        mRingMutex.unlock();
+        return nullptr;
+    }
+    return &mBuffer[mWrite];
+}
+
+void CBufferSystem::commit(uint32_t size)
+{
+    mWrite = (mWrite + size) % mSize;
+    mUsed += size;
+    mRingMutex.unlock();
+}
+
+bool CBufferSystem::split(int part, int fec, uint8_t fill)
+{
+    if ((part <= 0) || (part > 0xffff) || (mBuffer == nullptr))
+        return false;
+    uint32_t parts = (mSize + part - 1) / part;
+    if ((fec < 0) || ((uint32_t)fec > parts))
+    {
+        ESP_LOGE(TAG, "wrong fec %d for %" PRIu32 " parts", fec, parts);
+        return false;
+    }
+    uint32_t groups = (fec == 0) ? 0 : (parts + fec - 1) / fec;
+    if ((parts == 0) || ((parts + groups) > 0x10000))
+    {
+        ESP_LOGE(TAG, "too many parts %" PRIu32, parts + groups);
+        return false;
+    }
+    mPart = part;
+    mLastPart = parts - 1;
+    mFec = fec;
+    mGroups = groups;
+    mRecovered = 0;
+    mQueued = 0;
+    mQueuePos = 0;
+    mReceived = (fill != 0) ? (mLastPart + 1) : 0;
+    mContiguous = mReceived;
+    mPercent = 0;
+    mNotifyPercent = 0;
+    mNotifyStep = 0;
+    if (mGroups != 0)
+    {
+        mParity = buf_alloc(mGroups * mPart);
+        if (mParity == nullptr)
+            return false;
+    }
+    mParts = new uint8_t[mLastPart + 1 + mGroups];
+    std::memset(mParts, fill, mLastPart + 1 + mGroups);
+    return true;
+}
+
+void CBufferSystem::parity(uint16_t group, uint8_t *res)
+{
+    std::memset(res, 0, mPart);
+    uint16_t last = groupLast(group);
+    for (uint32_t i = group * mFec; i <= last; i++)
+    {
+        uint8_t *p = &mBuffer[i * mPart];
+        uint32_t sz = partSize(i);
+        for (uint32_t j = 0; j < sz; j++)
+            res[j] ^= p[j];
+    }
+}
+
+void CBufferSystem::recover(uint16_t group)
+{
+    if (mParts[mLastPart + 1 + group] == 0)
+        return;
+    uint16_t last = groupLast(group);
+    int missing = -1;
+    for (uint32_t i = group * mFec; i <= last; i++)
+    {
+        if (mParts[i] == 0)
+        {
+            if (missing != -1)
+                return;
+            missing = i;
+        }
+    }
+    if (missing == -1)
+        return;
+
+    // Пропущенный пакет - четность группы с учётом остальных пакетов, собирается на месте без выделения памяти.
+    uint8_t *p = &mBuffer[missing * mPart];
+    uint32_t sz = partSize(missing);
+    std::memcpy(p, &mParity[group * mPart], sz);
+    for (uint32_t i = group * mFec; i <= last; i++)
+    {
+        if (i == (uint32_t)missing)
+            continue;
+        const uint8_t *q = &mBuffer[i * mPart];
+        uint32_t n = std::min(sz, partSize(i));
+        for (uint32_t j = 0; j < n; j++)
+            p[j] ^= q[j];
+    }
+    mParts[missing] = 1;
+    mRecovered++;
+    ESP_LOGI(TAG, "part %d was recovered", missing);
+    received();
+}
+
+
+std::string CBufferSystem::delta(const std::string &fname, uint32_t block)
+{
+    if ((block < SPIFFS_BLOCK_MIN) || (block > SPIFFS_BLOCK_MAX))
+        return "\"error\":\"Wrong block of file " + fname + "\"";
+    if (mReceived != (mLastPart + 1U))
+        return "\"error\":\"Buf wasn't received\"";
+    std::string str = CSpiffsSystem::path(fname);
+    FILE *f = std::fopen(str.c_str(), "r");
+    if (f == nullptr)
+    {
+        ESP_LOGW(TAG, "Failed to open file %s", fname.c_str());
+        return "\"error\":\"Failed to open file " + fname + "\"";
+    }
+    FILE *out = std::fopen((str + '$').c_str(), "w");
+    if (out == nullptr)
+    {
+        std::fclose(f);
+        ESP_LOGW(TAG, "Failed to open file %s$", fname.c_str());
+        return "\"error\":\"Failed to open file " + fname + "$\"";
+    }
+
+    // Команды: 'C' номер_блока(4) количество(2) - копия блоков старого файла, 'L' размер(4) данные - новые данные.
+    std::string error;
+    uint32_t size = 0;
+    uint32_t copied = 0;
+    uint8_t *tmp = new uint8_t[block];
+    uint32_t i = 0;
+    while ((i < mSize) && error.empty())
+    {
+        uint8_t op = mBuffer[i];
+        if ((op == 'C') && ((i + 7) <= mSize))
+        {
+            uint32_t n;
+            uint16_t count;
+            std::memcpy(&n, &mBuffer[i + 1], 4);
+            std::memcpy(&count, &mBuffer[i + 5], 2);
+            i += 7;
+            if (((uint64_t)n * block) > 0x7fffffff)
+            {
+                error = "Failed to copy block " + std::to_string(n) + " of file " + fname;
+                break;
+            }
+            std::fseek(f, n * block, SEEK_SET);
+            for (uint16_t j = 0; (j < count) && error.empty(); j++)
+            {
+                size_t sz = std::fread(tmp, 1, block, f);
+                if ((sz == 0) || (std::fwrite(tmp, 1, sz, out) != sz))
+                    error = "Failed to copy block " + std::to_string(n + j) + " of file " + fname;
+                size += sz;
+                copied += sz;
+            }
+        }
+        else if ((op == 'L') && ((i + 5) <= mSize))
+        {
+            uint32_t sz;
+            std::memcpy(&sz, &mBuffer[i + 1], 4);
+            i += 5;
+            if ((sz > (mSize - i)) || (std::fwrite(&mBuffer[i], 1, sz, out) != sz))
+                error = "Failed to write data of file " + fname;
+            i += sz;
+            size += sz;
+        }
+        else
+            error = "Wrong delta command " + std::to_string(i);
+    }
+    delete[] tmp;
+    std::fclose(f);
+    if (std::fclose(out) != 0)
+        error = "Failed to write to file " + fname;
+
+    if (error.empty() && !CSpiffsSystem::commitFile(fname))
+        error = "Failed to commit file " + fname;
+    if (!error.empty())
+    {
+        std::remove((str + '$').c_str());
+        ESP_LOGW(TAG, "%s", error.c_str());
+        return "\"error\":\"" + error + "\"";
+    }
+    return "\"ok\":\"file " + fname + " was updated\",\"size\":" + std::to_string(size) + ",\"copied\":" + std::to_string(copied);
+}
+
+std::string CBufferSystem::flush()
+{
+    if (!mSink)
+        return "";
+    while (mFlushed < mContiguous)
+    {
+        if (!mSink->write(&mBuffer[mFlushed * mPart], partSize(mFlushed)))
+        {
+            ESP_LOGE(TAG, "Failed to write part %" PRIu32 " to sink %s", mFlushed, mSink->name().c_str());
+            mSinkError = "Failed to write to sink " + mSink->name();
+            mSink->cancel();
+            mSink.reset();
+            return mSinkError;
+        }
+        mFlushed++;
+    }
+    if (mFlushed <= mLastPart)
+        return "";
+    std::string res = "ok";
+    if (!mSink->commit())
+    {
+        mSinkError = "Failed to commit sink " + mSink->name();
+        res = mSinkError;
+    }
+    mSink.reset();
+    return res;
+}
+
+void CBufferSystem::received()
+{
+    mReceived++;
+    // Каждый пакет проходится один раз за передачу, поэтому в среднем O(1).
+    while ((mContiguous <= mLastPart) && (mParts[mContiguous] != 0))
+        mContiguous++;
+    std::string sink = flush();
+    uint8_t percent = (uint32_t)mReceived * 100 / (mLastPart + 1);
+    bool done = (mReceived == (mLastPart + 1U));
+    if (mHandler && (done || ((percent / mStep) > (mPercent / mStep))))
+    {
+        mPercent = percent;
+        mHandler(percent);
+    }
+    if (mNotify && (mNotifyStep != 0))
+    {
+        // Ошибка приёмника в начале передачи сообщается и в done.
+        if (done && sink.empty())
+            sink = mSinkError;
+        if (done)
+            mNotify("\"buf\":{\"done\":" + std::to_string(mSize) + (sink.empty() ? "" : (",\"sink\":\"" + sink + "\"")) + "}");
+        else if (!sink.empty())
+            mNotify("\"buf\":{\"error\":\"" + sink + "\"}");
+        else if ((percent / mNotifyStep) > (mNotifyPercent / mNotifyStep))
+        {
+            mNotifyPercent = percent;
+            mNotify("\"buf\":{\"progress\":" + std::to_string(percent) + "}");
+        }
+    }
+    if (done)
+        mStats.time = xTaskGetTickCount() - mStats.start;
+    if (done && (mEvents != nullptr))
+        xEventGroupSetBits(mEvents, mBits);
+}
+
+void CBufferSystem::setHandler(THandler handler, uint8_t step)
+{
+    mHandler = handler;
+    mStep = ((step == 0) || (step > 100)) ? 100 : step;
+}
+
+void CBufferSystem::setEventGroup(EventGroupHandle_t group, EventBits_t bits)
+{
+    mEvents = group;
+    mBits = bits;
+}
+
+void CBufferSystem::setNotify(TNotify notify)
+{
+    mNotify = notify;
+}
+
+std::string CBufferSystem::bundle(const std::vector<std::string> &names, int part, int fec)
+{
+    if (names.empty() || (part <= 0))
+        return "\"error\":\"No files\"";
+    std::vector<uint32_t> sizes;
+    for (auto &name : names)
+    {
+        FILE *f = std::fopen(CSpiffsSystem::path(name).c_str(), "r");
+        if (f == nullptr)
+        {
+            ESP_LOGW(TAG, "Failed to open file %s", name.c_str());
+            return "\"error\":\"Failed to open file " + CJsonParser::escape(name) + "\"";
+        }
+        std::fseek(f, 0, SEEK_END);
+        long sz = std::ftell(f);
+        std::fclose(f);
+        if (sz < 0)
+        {
+            ESP_LOGW(TAG, "Failed to read file %s", name.c_str());
+            return "\"error\":\"Failed to read file " + CJsonParser::escape(name) + "\"";
+        }
+        sizes.push_back(sz);
+    }
+
+    // Манифест занимает целое число пакетов, смещения файлов зависят от его размера.
+    // Размер манифеста не убывает с ростом смещений, поэтому цикл завершается, когда размер перестаёт меняться.
+    std::string manifest;
+    std::vector<size_t> crcs;
+    uint32_t start = part;
+    while (true)
+    {
+        manifest = "{\"files\":[";
+        crcs.clear();
+        uint32_t offset = start;
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            if (i != 0)
+                manifest += ',';
+            manifest += "{\"name\":\"" + CJsonParser::escape(names[i]) + "\",\"offset\":" + std::to_string(offset) + ",\"size\":" + std::to_string(sizes[i]) + ",\"crc\":\"";
+            crcs.push_back(manifest.size());
+            manifest += "00000000\"}";
+            offset += sizes[i];
+        }
+        manifest += "]}";
+        uint32_t sz = (manifest.size() + part - 1) / part * part;
+        if (sz == start)
+            break;
+        start = sz;
+    }
+
+    uint32_t total = start;
+    for (uint32_t sz : sizes)
+        total += sz;
+    if (!init(total))
+        return "\"error\":\"Buf wasn't created " + std::to_string(total) + "\"";
+    std::memcpy(mBuffer, manifest.data(), manifest.size());
+    std::memset(&mBuffer[manifest.size()], ' ', start - manifest.size());
+    uint32_t offset = start;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        FILE *f = std::fopen(CSpiffsSystem::path(names[i]).c_str(), "r");
+        size_t sz = (f == nullptr) ? 0 : std::fread(&mBuffer[offset], 1, sizes[i], f);
+        if (f != nullptr)
+            std::fclose(f);
+        if (sz != sizes[i])
+        {
+            free();
+            return "\"error\":\"Failed to read file " + CJsonParser::escape(names[i]) + "\"";
+        }
+        char tmp[9];
+        std::sprintf(tmp, "%08lx", (unsigned long)esp_rom_crc32_le(0, &mBuffer[offset], sizes[i]));
+        std::memcpy(&mBuffer[crcs[i]], tmp, 8);
+        offset += sizes[i];
+    }
+    if (!split(part, fec, 1))
+    {
+        free();
+        return "\"error\":\"Buf wasn't created " + std::to_string(total) + "\"";
+    }
+    for (uint16_t g = 0; g < mGroups; g++)
+        parity(g, &mParity[g * mPart]);
+    mRead = true;
+
+    std::string res = "\"fr\":[";
+    for (size_t i = 0; i < names.size(); i++)
+        res += ((i == 0) ? "\"" : ",\"") + CJsonParser::escape(names[i]) + "\"";
+    res += "],\"ok\":\"bundle was loaded\",\"size\":" + std::to_string(mSize) + ",\"part\":" + std::to_string(mPart);
+    res += ",\"manifest\":" + std::to_string(start);
+    if (mFec != 0)
+        res += ",\"fec\":" + std::to_string(mFec) + ",\"parity\":" + std::to_string(mLastPart + 1);
     return res;
 }
\ No newline at end of file
@@ -0,0 +1,350 @@
+/*!
+    \file
+    \brief Класс хранилища настроек из json файла SPIFFS.
+    \authors Близнец Р.А. (r.bliznets@gmail.com)
+    \version 0.1.0.0
+    \date 17.10.2026
+*/
+
+#include "CConfigStore.h"
+#include "CSpiffsSystem.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+static const char *TAG = "config";
+
+/// Сегмент пути JSON Pointer с заменой '~' на "~0" и '/' на "~1".
+static std::string pointer_escape(const std::string &name)
+{
+    std::string res;
+    for (char c : name)
+    {
+        if (c == '~')
+            res += "~0";
+        else if (c == '/')
+            res += "~1";
+        else
+            res += c;
+    }
+    return res;
+}
+
+CConfigStore::~CConfigStore()
+{
+    flush(true);
+}
+
+uint32_t CConfigStore::hash(const std::string &path)
+{
+    uint32_t h = 2166136261UL;
+    for (char c : path)
+    {
+        h ^= (uint8_t)c;
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+void CConfigStore::walk(CJsonParser &doc, int i, const std::string &path, const std::function<void(int i, uint32_t hash)> &handler)
+{
+    int first;
+    if (doc.getObject(i, first))
+    {
+        for (auto [k, v] : doc.members(first))
+        {
+            std::string name;
+            doc.getString(k, name);
+            walk(doc, v, path + "/" + pointer_escape(CJsonParser::unescape(name.c_str(), name.size())), handler);
+        }
+        return;
+    }
+    if (doc.getArray(i, first))
+    {
+        int n = 0;
+        for (int v : doc.elements(first))
+            walk(doc, v, path + "/" + std::to_string(n++), handler);
+        return;
+    }
+    std::string text;
+    if (doc.getText(i, text) && ((text == "{}") || (text == "[]")))
+        return;
+    handler(i, hash(path));
+}
+
+int CConfigStore::find(uint32_t hash, int hint)
+{
+    int n = mValues.size();
+    for (int j = 0; j < n; j++)
+    {
+        int k = (hint + j) % n;
+        if (mValues[k].hash == hash)
+            return k;
+    }
+    return -1;
+}
+
+bool CConfigStore::load()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mValues.clear();
+    mDirty = false;
+    std::string json;
+    if (!CSpiffsSystem::readFile(mFileName, json))
+    {
+        ESP_LOGW(TAG, "Failed to open file %s", mFileName.c_str());
+        return false;
+    }
+    CJsonParser doc;
+    if (doc.parse(json.c_str()) != 1)
+    {
+        ESP_LOGW(TAG, "Failed to parse file %s", mFileName.c_str());
+        return false;
+    }
+    auto add = [this, &doc](int i, uint32_t hash)
+    {
+        SValue value;
+        value.hash = hash;
+        value.dirty = false;
+        value.i = 0;
+        if (doc.getString(i, value.s))
+        {
+            value.kind = SJsonField::STRING;
+            value.s = CJsonParser::unescape(value.s.c_str(), value.s.size());
+        }
+        else if (doc.getBool(i, value.b))
+            value.kind = SJsonField::BOOL;
+        else if (doc.isNull(i))
+            value.kind = SJsonField::NONE;
+        else
+        {
+            std::string text;
+            doc.getText(i, text);
+            if (text.find_first_of(".eE") != std::string::npos)
+            {
+                value.kind = SJsonField::FLOAT;
+                doc.getFloat(i, value.f);
+            }
+            else
+            {
+                value.kind = SJsonField::INT;
+                doc.getInt(i, value.i);
+            }
+        }
+        mValues.push_back(value);
+    };
+    walk(doc, 0, "", add);
+    return true;
+}
+
+int CConfigStore::key(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return find(hash(path), 0);
+}
+
+bool CConfigStore::getInt(int key, int &value)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if ((key < 0) || (key >= (int)mValues.size()))
+        return false;
+    const SValue &v = mValues[key];
+    if (v.kind == SJsonField::INT)
+        value = v.i;
+    else if (v.kind == SJsonField::FLOAT)
+        value = (int)v.f;
+    else
+        return false;
+    return true;
+}
+
+bool CConfigStore::getFloat(int key, float &value)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if ((key < 0) || (key >= (int)mValues.size()))
+        return false;
+    const SValue &v = mValues[key];
+    if (v.kind == SJsonField::FLOAT)
+        value = v.f;
+    else if (v.kind == SJsonField::INT)
+        value = v.i;
+    else
+        return false;
+    return true;
+}
+
+bool CConfigStore::getBool(int key, bool &value)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if ((key < 0) || (key >= (int)mValues.size()) || (mValues[key].kind != SJsonField::BOOL))
+        return false;
+    value = mValues[key].b;
+    return true;
+}
+
+bool CConfigStore::getString(int key, std::string &value)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if ((key < 0) || (key >= (int)mValues.size()) || (mValues[key].kind != SJsonField::STRING))
+        return false;
+    value = mValues[key].s;
+    return true;
+}
+
+bool CConfigStore::isNull(int key)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return (key >= 0) && (key < (int)mValues.size()) && (mValues[key].kind == SJsonField::NONE);
+}
+
+bool CConfigStore::isDirty()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mDirty;
+}
+
+bool CConfigStore::change(int key, SJsonField::EKind kind, const void *value)
+{
+    std::vector<THandler> handlers;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if ((key < 0) || (key >= (int)mValues.size()))
+            return false;
+        SValue &v = mValues[key];
+        bool number = ((v.kind == SJsonField::INT) || (v.kind == SJsonField::FLOAT)) && ((kind == SJsonField::INT) || (kind == SJsonField::FLOAT));
+        if ((v.kind != kind) && (v.kind != SJsonField::NONE) && !number)
+            return false;
+
+        bool changed = (v.kind != kind);
+        switch (kind)
+        {
+        case SJsonField::INT:
+            changed |= (v.i != *(const int *)value);
+            v.i = *(const int *)value;
+            break;
+        case SJsonField::FLOAT:
+            changed |= (v.f != *(const float *)value);
+            v.f = *(const float *)value;
+            break;
+        case SJsonField::BOOL:
+            changed |= (v.b != *(const bool *)value);
+            v.b = *(const bool *)value;
+            break;
+        case SJsonField::STRING:
+            changed |= (v.s != *(const std::string *)value);
+            v.s = *(const std::string *)value;
+            break;
+        default:
+            return false;
+        }
+        v.kind = kind;
+        if (!changed)
+            return true;
+
+        v.dirty = true;
+        mDirty = true;
+        mChangeTime = xTaskGetTickCount();
+        for (auto &s : mSubscribers)
+        {
+            if ((s.key == -1) || (s.key == key))
+                handlers.push_back(s.handler);
+        }
+    }
+    // Обработчики могут читать и изменять значения.
+    for (auto &h : handlers)
+        h(key);
+    return true;
+}
+
+int CConfigStore::subscribe(int key, THandler handler)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSubscribers.push_back({mNextId, key, handler});
+    return mNextId++;
+}
+
+void CConfigStore::unsubscribe(int id)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto it = mSubscribers.begin(); it != mSubscribers.end(); it++)
+    {
+        if (it->id == id)
+        {
+            mSubscribers.erase(it);
+            return;
+        }
+    }
+}
+
+std::string CConfigStore::text(const SValue &value)
+{
+    char tmp[20];
+    switch (value.kind)
+    {
+    case SJsonField::INT:
+        return std::to_string(value.i);
+    case SJsonField::FLOAT:
+    {
+        if (!std::isfinite(value.f))
+            return "null";
+        std::snprintf(tmp, sizeof(tmp), "%.9g", value.f);
+        std::string text = tmp;
+        if (text.find_first_of(".eE") == std::string::npos)
+            text += ".0";
+        return text;
+    }
+    case SJsonField::BOOL:
+        return value.b ? "true" : "false";
+    case SJsonField::STRING:
+        return "\"" + CJsonParser::escape(value.s) + "\"";
+    default:
+        return "null";
+    }
+}
+
+bool CConfigStore::flush(bool force)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mDirty)
+        return true;
+    if (!force && ((xTaskGetTickCount() - mChangeTime) < pdMS_TO_TICKS(CONFIG_JSON_CONFIG_DELAY)))
+        return false;
+
+    std::string json;
+    CJsonParser doc;
+    if (!CSpiffsSystem::readFile(mFileName, json) || (doc.parse(json.c_str()) != 1))
+    {
+        ESP_LOGW(TAG, "Failed to read file %s", mFileName.c_str());
+        return false;
+    }
+    // Изменённые значения заменяются в тексте файла за один проход, остальной текст сохраняется без изменений.
+    // Значения в файле и в mValues идут в одном порядке, поиск по хешу пути начинается со следующего за найденным.
+    std::vector<std::pair<int, std::string>> values;
+    int hint = 0;
+    auto collect = [this, &values, &hint](int i, uint32_t hash)
+    {
+        int k = find(hash, hint);
+        if (k == -1)
+            return;
+        hint = k + 1;
+        if (mValues[k].dirty)
+            values.emplace_back(i, text(mValues[k]));
+    };
+    walk(doc, 0, "", collect);
+    size_t dirty = 0;
+    for (auto &v : mValues)
+        dirty += v.dirty ? 1 : 0;
+    if (values.size() != dirty)
+        ESP_LOGW(TAG, "%d changed values are missing in file %s", (int)(dirty - values.size()), mFileName.c_str());
+    if (!doc.replace(values, json) || !CSpiffsSystem::writeFile(mFileName, json))
+    {
+        ESP_LOGW(TAG, "Failed to write to file %s", mFileName.c_str());
+        return false;
+    }
+    for (auto &v : mValues)
+        v.dirty = false;
+    mDirty = false;
+    return true;
+}
@@ -0,0 +1,213 @@
+/*!
+    \file
+    \brief Файловые системы для CSpiffsSystem.
+    \authors Близнец Р.А. (r.bliznets@gmail.com)
+    \version 0.1.0.0
+    \date 17.10.2026
+*/
+
+#include "CFsBackend.h"
+#include "esp_log.h"
+#include "esp_err.h"
+#include <cstdio>
+
+#ifdef CONFIG_FS_SPIFFS
+#include "esp_spiffs.h"
+#endif
+#ifdef CONFIG_FS_LITTLEFS
+#include "esp_littlefs.h"
+#endif
+#ifdef CONFIG_FS_FAT
+#include "esp_vfs_fat.h"
+#endif
+#ifdef CONFIG_FS_POSIX
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#endif
+
+static const char *TAG = "fs";
+
+CFsBackend *CFsBackend::create()
+{
+#if defined(CONFIG_FS_LITTLEFS)
+    return new CLittleFsBackend(CONFIG_FS_BASE_PATH, CONFIG_FS_PARTITION_LABEL);
+#elif defined(CONFIG_FS_FAT)
+    return new CFatBackend(CONFIG_FS_BASE_PATH, CONFIG_FS_PARTITION_LABEL);
+#elif defined(CONFIG_FS_POSIX)
+    return new CPosixBackend(CONFIG_FS_BASE_PATH, CONFIG_FS_PARTITION_LABEL);
+#else
+    return new CSpiffsBackend(CONFIG_FS_BASE_PATH, CONFIG_FS_PARTITION_LABEL);
+#endif
+}
+
+#ifdef CONFIG_FS_SPIFFS
+bool CSpiffsBackend::mount()
+{
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = mBase.c_str(),
+        .partition_label = label(),
+        .max_files = 15,
+        .format_if_mount_failed = true};
+    esp_err_t ret = esp_vfs_spiffs_register(&conf);
+    if (ret != ESP_OK)
+    {
+        if (ret == ESP_FAIL)
+        {
+            ESP_LOGE(TAG, "Failed to mount or format filesystem");
+        }
+        else if (ret == ESP_ERR_NOT_FOUND)
+        {
+            ESP_LOGE(TAG, "Failed to find SPIFFS partition");
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
+        }
+        return false;
+    }
+    return true;
+}
+
+void CSpiffsBackend::unmount()
+{
+    esp_vfs_spiffs_unregister(label());
+}
+
+bool CSpiffsBackend::check()
+{
+    ESP_LOGI(TAG, "SPIFFS checking...");
+    esp_err_t ret = esp_spiffs_check(label());
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "SPIFFS_check() failed (%s)", esp_err_to_name(ret));
+        return false;
+    }
+    ESP_LOGI(TAG, "SPIFFS_check() successful");
+    return true;
+}
+
+void CSpiffsBackend::gc()
+{
+    esp_spiffs_gc(label(), 0x100000);
+}
+
+bool CSpiffsBackend::info(size_t &total, size_t &used)
+{
+    return esp_spiffs_info(label(), &total, &used) == ESP_OK;
+}
+
+bool CSpiffsBackend::format()
+{
+    return esp_spiffs_format(label()) == ESP_OK;
+}
+#endif // CONFIG_FS_SPIFFS
+
+#ifdef CONFIG_FS_LITTLEFS
+bool CLittleFsBackend::mount()
+{
+    esp_vfs_littlefs_conf_t conf = {};
+    conf.base_path = mBase.c_str();
+    conf.partition_label = label();
+    conf.format_if_mount_failed = true;
+    esp_err_t ret = esp_vfs_littlefs_register(&conf);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to initialize LittleFS (%s)", esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
+
+void CLittleFsBackend::unmount()
+{
+    esp_vfs_littlefs_unregister(label());
+}
+
+bool CLittleFsBackend::info(size_t &total, size_t &used)
+{
+    return esp_littlefs_info(label(), &total, &used) == ESP_OK;
+}
+
+bool CLittleFsBackend::format()
+{
+    return esp_littlefs_format(label()) == ESP_OK;
+}
+#endif // CONFIG_FS_LITTLEFS
+
+#ifdef CONFIG_FS_FAT
+bool CFatBackend::mount()
+{
+    esp_vfs_fat_mount_config_t conf = {};
+    conf.format_if_mount_failed = true;
+    conf.max_files = 15;
+    conf.allocation_unit_size = CONFIG_WL_SECTOR_SIZE;
+    esp_err_t ret = esp_vfs_fat_spiflash_mount_rw_wl(mBase.c_str(), label(), &conf, &mWl);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to initialize FAT (%s)", esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
+
+void CFatBackend::unmount()
+{
+    esp_vfs_fat_spiflash_unmount_rw_wl(mBase.c_str(), mWl);
+    mWl = WL_INVALID_HANDLE;
+}
+
+bool CFatBackend::info(size_t &total, size_t &used)
+{
+    uint64_t t;
+    uint64_t f;
+    if (esp_vfs_fat_info(mBase.c_str(), &t, &f) != ESP_OK)
+        return false;
+    total = t;
+    used = t - f;
+    return true;
+}
+
+bool CFatBackend::format()
+{
+    return esp_vfs_fat_spiflash_format_rw_wl(mBase.c_str(), label()) == ESP_OK;
+}
+#endif // CONFIG_FS_FAT
+
+#ifdef CONFIG_FS_POSIX
+bool CPosixBackend::mount()
+{
+    struct stat st;
+    if ((stat(mBase.c_str(), &st) != 0) && (mkdir(mBase.c_str(), 0755) != 0))
+    {
+        ESP_LOGE(TAG, "Failed to create dir %s", mBase.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool CPosixBackend::info(size_t &total, size_t &used)
+{
+    struct statvfs st;
+    if (statvfs(mBase.c_str(), &st) != 0)
+        return false;
+    total = st.f_blocks * st.f_frsize;
+    used = (st.f_blocks - st.f_bfree) * st.f_frsize;
+    return true;
+}
+
+bool CPosixBackend::format()
+{
+    DIR *dp = opendir(mBase.c_str());
+    if (dp == nullptr)
+        return false;
+    struct dirent *entry;
+    while ((entry = readdir(dp)))
+    {
+        if (entry->d_type == DT_REG)
+            std::remove((mBase + "/" + entry->d_name).c_str());
+    }
+    closedir(dp);
+    return true;
+}
+#endif // CONFIG_FS_POSIX
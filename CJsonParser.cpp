@@ -14,240 +14,1679 @@
 #include "CJsonParser.h"
 #include <cstring>
 #include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <cerrno>
+#include <climits>
+#include <vector>
+#include <algorithm>
 #include "sdkconfig.h"
 #include "esp_log.h"
 
 static const char* TAG="CJsonParser";
 
-CJsonParser::CJsonParser() : mRootTokensSize(CONFIG_JSON_MIN_TOKEN_SIZE)
+/// Заполнить токен.
+static inline void set_token(SJsonToken *tok, EJsonType type, size_t start, size_t end)
 {
-	mRootTokens = new jsmntok_t[mRootTokensSize];
+	tok->start = start;
+	tok->len = end - start;
+	tok->type = type;
+	tok->next = 0;
 }
 
-CJsonParser::~CJsonParser()
+/// Связать токен с предыдущим соседом.
+static inline void link_token(SJsonToken *tokens, int prev, int i)
 {
-	delete[] mRootTokens;
+	int d = i - prev;
+	tokens[prev].next = (d < JSON_TOKEN_FAR) ? d : JSON_TOKEN_FAR;
 }
 
-int CJsonParser::parse(const char *json)
+typedef size_t swar_t; ///< Машинное слово для SWAR.
+
+static const swar_t SWAR_ONES = (~(swar_t)0) / 0xff; ///< 0x0101...01
+static const swar_t SWAR_HIGH = SWAR_ONES * 0x80;	 ///< 0x8080...80
+#define SWAR_MIN_RUN (16) ///< Байт строки, проверяемых по одному до поиска по словам.
+
+/// Маска байтов слова, равных c (младший установленный бит точный).
+static inline swar_t swar_eq(swar_t v, uint8_t c)
 {
-	jsmn_init(&mParser);
-	mJson.clear();
+	v ^= SWAR_ONES * c;
+	return (v - SWAR_ONES) & ~v & SWAR_HIGH;
+}
 
-	mRootSize = jsmn_parse(&mParser, (const char *)json, std::strlen(json), mRootTokens, mRootTokensSize);
-	if (mRootSize < 0)
+/// Поиск первого '"' или '\\' начиная с pos.
+/*!
+  \return позиция найденного символа, либо len
+*/
+static size_t swar_find_quote(const char *js, size_t len, size_t pos)
+{
+	// Короткие строки и части между escape-последовательностями быстрее проверить по байтам,
+	// затем слова читаются по выровненным адресам (на Xtensa невыровненное чтение - исключение LoadStoreAlignment).
+	for (size_t end = std::min(len, pos + SWAR_MIN_RUN); pos < end; pos++)
 	{
-		if (mRootSize == JSMN_ERROR_INVAL)
+		if ((js[pos] == '"') || (js[pos] == '\\'))
+			return pos;
+	}
+	while ((pos < len) && (((uintptr_t)&js[pos] % sizeof(swar_t)) != 0))
+	{
+		if ((js[pos] == '"') || (js[pos] == '\\'))
+			return pos;
+		pos++;
+	}
+	while ((pos + sizeof(swar_t)) <= len)
+	{
+		swar_t v;
+		std::memcpy(&v, __builtin_assume_aligned(&js[pos], sizeof(swar_t)), sizeof(swar_t));
+		swar_t m = swar_eq(v, '"') | swar_eq(v, '\\');
+		if (m != 0)
+			return pos + (__builtin_ctzll(m) >> 3);
+		pos += sizeof(swar_t);
+	}
+	while ((pos < len) && (js[pos] != '"') && (js[pos] != '\\'))
+		pos++;
+	return pos;
+}
+
+/// Ожидаемый элемент для swar_scan.
+enum ESwarExpect
+{
+	EXPECT_VALUE, ///< Значение.
+	EXPECT_KEY,	  ///< Ключ объекта.
+	EXPECT_COLON, ///< ':'.
+	EXPECT_NEXT,  ///< ',' либо конец объекта/массива.
+	EXPECT_END	  ///< Только пробелы.
+};
+
+#define JSON_SCAN_ABORT (-4) ///< Разбор прерван обработчиком.
+
+/// Сканер json с поиском кавычек по словам.
+/*!
+  Проверяет структуру, строки сканируются по sizeof(size_t) байт за шаг, память O(глубины вложенности).
+  Для каждого элемента вызываются методы обработчика H:
+  - int value(EJsonType type, size_t start, size_t end, bool key, bool member, int depth) для строк и примитивов;
+  - int open(bool obj, size_t pos, bool member, int depth) для начала объекта/массива;
+  - int close(bool obj, size_t pos, int depth) для конца объекта/массива.
+
+  member - ключ объекта или элемент массива, depth - уровень элемента (0 - корень).
+  Отрицательный результат метода прерывает разбор.
+  \param[in] multi разрешить несколько корневых элементов подряд (NDJSON).
+  \return 0 в случае успеха, иначе код ошибки
+*/
+template <class H>
+static int swar_scan(const char *js, size_t len, H &h, bool multi = false)
+{
+	ESwarExpect end = multi ? EXPECT_VALUE : EXPECT_END; // ожидание после корневого элемента
+	uint64_t objs = 0; // бит уровня: 1 - объект, 0 - массив
+	int depth = 0;
+	int res;
+	ESwarExpect expect = EXPECT_VALUE;
+	for (size_t pos = 0; pos < len; pos++)
+	{
+		char c = js[pos];
+		switch (c)
 		{
-			ESP_LOGE(TAG, "bad token, JSON string is corrupted");
-			return -1;
-		}
-		else if (mRootSize == JSMN_ERROR_PART)
+		case '{':
+		case '[':
+			if ((expect != EXPECT_VALUE) || (depth == CONFIG_JSON_MAX_DEPTH))
+				return JSMN_ERROR_INVAL;
+			res = h.open(c == '{', pos, (depth > 0) && ((objs & (1ULL << (depth - 1))) == 0), depth);
+			if (res < 0)
+				return res;
+			if (c == '{')
+				objs |= (1ULL << depth);
+			else
+				objs &= ~(1ULL << depth);
+			depth++;
+			expect = (c == '{') ? EXPECT_KEY : EXPECT_VALUE;
+			break;
+		case '}':
+		case ']':
+			if ((depth == 0) || (((objs & (1ULL << (depth - 1))) != 0) != (c == '}')))
+				return JSMN_ERROR_INVAL;
+			if ((expect != EXPECT_NEXT) && (expect != ((c == '}') ? EXPECT_KEY : EXPECT_VALUE)))
+				return JSMN_ERROR_INVAL;
+			depth--;
+			res = h.close(c == '}', pos, depth);
+			if (res < 0)
+				return res;
+			expect = (depth == 0) ? end : EXPECT_NEXT;
+			break;
+		case '"':
 		{
-			ESP_LOGE(TAG, "JSON string is too short");
-			return -1;
+			if ((expect != EXPECT_KEY) && (expect != EXPECT_VALUE))
+				return JSMN_ERROR_INVAL;
+			size_t start = pos;
+			pos = swar_find_quote(js, len, pos + 1);
+			while ((pos < len) && (js[pos] == '\\'))
+			{
+				pos++;
+				if (pos >= len)
+					break;
+				switch (js[pos])
+				{
+				case '"':
+				case '/':
+				case '\\':
+				case 'b':
+				case 'f':
+				case 'r':
+				case 'n':
+				case 't':
+					pos++;
+					break;
+				case 'u':
+					pos++;
+					for (int j = 0; (j < 4) && (pos < len); j++, pos++)
+					{
+						if (!std::isxdigit((unsigned char)js[pos]))
+							return JSMN_ERROR_INVAL;
+					}
+					break;
+				default:
+					return JSMN_ERROR_INVAL;
+				}
+				pos = swar_find_quote(js, len, pos);
+			}
+			if (pos >= len)
+				return JSMN_ERROR_PART;
+			res = h.value(JSON_STRING, start + 1, pos, expect == EXPECT_KEY, (expect == EXPECT_KEY) || ((depth > 0) && ((objs & (1ULL << (depth - 1))) == 0)), depth);
+			if (res < 0)
+				return res;
+			expect = (expect == EXPECT_KEY) ? EXPECT_COLON : ((depth == 0) ? end : EXPECT_NEXT);
+			break;
 		}
-		else if (mRootSize == JSMN_ERROR_NOMEM)
+		case '\t':
+		case '\r':
+		case '\n':
+		case ' ':
+			break;
+		case ':':
+			if (expect != EXPECT_COLON)
+				return JSMN_ERROR_INVAL;
+			expect = EXPECT_VALUE;
+			break;
+		case ',':
+			if (expect != EXPECT_NEXT)
+				return JSMN_ERROR_INVAL;
+			expect = ((objs & (1ULL << (depth - 1))) != 0) ? EXPECT_KEY : EXPECT_VALUE;
+			break;
+		default:
 		{
-			delete[] mRootTokens;
-			mRootTokensSize = jsmn_parse(&mParser, (const char *)json, std::strlen(json), nullptr, 0) + 1;
-			mRootTokens = new jsmntok_t[mRootTokensSize];
-			jsmn_init(&mParser);
-			mRootSize = jsmn_parse(&mParser, (const char *)json, std::strlen(json), mRootTokens, mRootTokensSize);
+			if ((expect != EXPECT_KEY) && (expect != EXPECT_VALUE))
+				return JSMN_ERROR_INVAL;
+			size_t start = pos;
+			for (; pos < len; pos++)
+			{
+				c = js[pos];
+				if ((c == ':') || (c == ',') || (c == ']') || (c == '}') || (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n'))
+					break;
+				if ((c < 32) || (c >= 127))
+					return JSMN_ERROR_INVAL;
+			}
+			if (pos >= len)
+				return JSMN_ERROR_PART;
+			res = h.value(JSON_PRIMITIVE, start, pos, expect == EXPECT_KEY, (expect == EXPECT_KEY) || ((depth > 0) && ((objs & (1ULL << (depth - 1))) == 0)), depth);
+			if (res < 0)
+				return res;
+			expect = (expect == EXPECT_KEY) ? EXPECT_COLON : ((depth == 0) ? end : EXPECT_NEXT);
+			pos--;
+			break;
+		}
 		}
+	}
+	if (depth != 0)
+		return JSMN_ERROR_PART;
+	return 0;
+}
+
+/// Передача событий swar_scan обработчику CJsonHandler.
+struct SSaxAdapter
+{
+	CJsonHandler *handler; ///< Обработчик.
+	const char *js;		   ///< Строка json.
+
+	int value(EJsonType type, size_t start, size_t end, bool key, bool member, int depth)
+	{
+		const char *str = &js[start];
+		size_t len = end - start;
+		bool res;
+		if (key)
+			res = handler->onKey(str, len);
+		else if (type == JSON_STRING)
+			res = handler->onString(str, len);
+		else if ((len == 4) && (std::memcmp(str, "true", 4) == 0))
+			res = handler->onBool(true);
+		else if ((len == 5) && (std::memcmp(str, "false", 5) == 0))
+			res = handler->onBool(false);
+		else if ((len == 4) && (std::memcmp(str, "null", 4) == 0))
+			res = handler->onNull();
 		else
+			res = handler->onNumber(str, len);
+		return res ? 0 : JSON_SCAN_ABORT;
+	}
+	int open(bool obj, size_t pos, bool member, int depth)
+	{
+		return (obj ? handler->onBeginObject() : handler->onBeginArray()) ? 0 : JSON_SCAN_ABORT;
+	}
+	int close(bool obj, size_t pos, int depth)
+	{
+		return (obj ? handler->onEndObject() : handler->onEndArray()) ? 0 : JSON_SCAN_ABORT;
+	}
+};
+
+/// Построение таблицы компактных токенов по событиям swar_scan.
+struct STableBuilder
+{
+	SJsonToken *tokens;				 ///< Массив токенов (nullptr - только подсчет).
+	unsigned int num;				 ///< Размер массива токенов.
+	int count;						 ///< Количество токенов.
+	int tok[CONFIG_JSON_MAX_DEPTH];	 ///< Индексы открытых объектов/массивов.
+	int last[CONFIG_JSON_MAX_DEPTH]; ///< Индексы последних ключей/элементов на уровне.
+	int root;						 ///< Индекс последнего корневого элемента.
+
+	STableBuilder(SJsonToken *tokens, unsigned int num) : tokens(tokens), num(num), count(0), root(-1) {};
+
+	int value(EJsonType type, size_t start, size_t end, bool key, bool member, int depth)
+	{
+		int i = count++;
+		if (tokens == nullptr)
+			return i;
+		if (i >= (int)num)
+			return JSMN_ERROR_NOMEM;
+		set_token(&tokens[i], type, start, end);
+		if (member)
 		{
-			ESP_LOGE(TAG, "JSON string error");
-			return -1;
+			if (last[depth - 1] != -1)
+				link_token(tokens, last[depth - 1], i);
+			last[depth - 1] = i;
+		}
+		else if (depth == 0)
+		{
+			if (root != -1)
+				link_token(tokens, root, i);
+			root = i;
 		}
+		return i;
 	}
-	if ((mRootSize > 1) && (mRootTokens[0].type == JSMN_OBJECT))
+	int open(bool obj, size_t pos, bool member, int depth)
 	{
-		mJson = json;
-		return 1;
+		int i = value(obj ? JSON_OBJECT : JSON_ARRAY, pos, pos, false, member, depth);
+		if (i < 0)
+			return i;
+		tok[depth] = i;
+		last[depth] = -1;
+		return 0;
 	}
-	else
+	int close(bool obj, size_t pos, int depth)
 	{
-		ESP_LOGE(TAG, "root error");
+		if (tokens != nullptr)
+			tokens[tok[depth]].len = pos + 1 - tokens[tok[depth]].start;
 		return 0;
 	}
-}
+};
+
+#define CBOR_INDEFINITE (~0ULL) ///< Аргумент массива/объекта CBOR неопределенной длины.
 
-bool CJsonParser::getString(int beg, const char *name, std::string &value)
+/// Разбор заголовка элемента CBOR.
+/*!
+  \param[in] data данные CBOR.
+  \param[in] size размер данных.
+  \param[in,out] pos позиция заголовка, после вызова - позиция за заголовком.
+  \param[out] major основной тип.
+  \param[out] arg аргумент (длина, значение или биты числа с плавающей точкой).
+  \return 0 в случае успеха, иначе JSMN_ERROR_*
+*/
+static int cbor_head(const uint8_t *data, size_t size, size_t &pos, uint8_t &major, uint64_t &arg)
 {
-	if (mJson.empty())
-		return false;
+	if (pos >= size)
+		return JSMN_ERROR_PART;
+	uint8_t ai = data[pos] & 0x1f;
+	major = data[pos++] >> 5;
+	if (ai < 24)
+	{
+		arg = ai;
+	}
+	else if (ai <= 27)
+	{
+		size_t n = 1 << (ai - 24);
+		if ((pos + n) > size)
+			return JSMN_ERROR_PART;
+		arg = 0;
+		for (size_t i = 0; i < n; i++)
+			arg = (arg << 8) | data[pos++];
+	}
+	else if ((ai == 31) && ((major == 4) || (major == 5)))
+	{
+		arg = CBOR_INDEFINITE;
+	}
+	else
+	{
+		// Строки неопределенной длины и зарезервированные значения не поддерживаются.
+		return JSMN_ERROR_INVAL;
+	}
+	return 0;
+}
 
-	int sz = std::strlen(name);
-	for (int i = beg; (i < (mRootSize - 1)) && (mRootTokens[beg].parent <= mRootTokens[i].parent); i++)
+/// Разбор элемента CBOR в таблицу токенов.
+/*!
+  Строки (текстовые и байтовые) - JSON_STRING с началом на данных строки,
+  числа, true, false, null - JSON_PRIMITIVE с началом на заголовке элемента.
+  Теги пропускаются, цепочка тегов ограничена CONFIG_JSON_MAX_DEPTH.
+  \return 0 в случае успеха, иначе JSMN_ERROR_*
+*/
+static int cbor_item(const uint8_t *data, size_t size, size_t &pos, STableBuilder &builder, bool key, bool member, int depth)
+{
+	size_t start;
+	uint8_t major;
+	uint64_t arg;
+	int res;
+	int tags = 0;
+	do
+	{
+		start = pos;
+		res = cbor_head(data, size, pos, major, arg);
+		if (res < 0)
+			return res;
+		if ((major == 6) && (++tags > CONFIG_JSON_MAX_DEPTH))
+			return JSMN_ERROR_INVAL;
+	} while (major == 6);
+	switch (major)
 	{
-		if (mRootTokens[beg].parent == mRootTokens[i].parent)
+	case 0:
+	case 1:
+	case 7:
+		if (key)
+			return JSMN_ERROR_INVAL;
+		res = builder.value(JSON_PRIMITIVE, start, pos, false, member, depth);
+		break;
+	case 2:
+	case 3:
+		if (key && (major != 3))
+			return JSMN_ERROR_INVAL;
+		if (arg > (size - pos))
+			return JSMN_ERROR_PART;
+		res = builder.value(JSON_STRING, pos, pos + arg, key, member, depth);
+		pos += arg;
+		break;
+	case 4:
+	case 5:
+		if (key || (depth >= CONFIG_JSON_MAX_DEPTH))
+			return JSMN_ERROR_INVAL;
+		res = builder.open(major == 5, start, member, depth);
+		for (uint64_t i = 0; (res >= 0) && ((arg == CBOR_INDEFINITE) ? ((pos < size) && (data[pos] != 0xff)) : (i < arg)); i++)
 		{
-			if ((sz == (mRootTokens[i].end - mRootTokens[i].start)) && (std::memcmp(name, &mJson[mRootTokens[i].start], sz) == 0))
+			if (major == 5)
 			{
-				if ((mRootTokens[i + 1].type == JSMN_STRING) && (mRootTokens[i + 1].parent == i))
-				{
-					value = mJson.substr(mRootTokens[i + 1].start, (mRootTokens[i + 1].end - mRootTokens[i + 1].start));
-					return true;
-				}
+				res = cbor_item(data, size, pos, builder, true, true, depth + 1);
+				if (res >= 0)
+					res = cbor_item(data, size, pos, builder, false, false, depth + 1);
 			}
+			else
+				res = cbor_item(data, size, pos, builder, false, true, depth + 1);
 		}
+		if ((res >= 0) && (arg == CBOR_INDEFINITE))
+		{
+			if (pos >= size)
+				return JSMN_ERROR_PART;
+			pos++;
+		}
+		if (res >= 0)
+			res = builder.close(major == 5, pos - 1, depth);
+		break;
 	}
-	return false;
+	return (res < 0) ? res : 0;
 }
 
-bool CJsonParser::getField(int beg, const char *name)
+/// Разбор документа CBOR в таблицу токенов.
+/*!
+  \return количество токенов, либо код ошибки JSMN_ERROR_*
+*/
+static int cbor_parse(const uint8_t *data, size_t size, SJsonToken *tokens, unsigned int num)
 {
-	if (mJson.empty())
+	STableBuilder builder(tokens, num);
+	size_t pos = 0;
+	int res = cbor_item(data, size, pos, builder, false, false, 0);
+	if (res < 0)
+		return res;
+	return (pos == size) ? builder.count : JSMN_ERROR_INVAL;
+}
+
+/// Значение числа CBOR.
+/*!
+  \param[in] p заголовок элемента.
+  \param[out] value значение.
+  \return true, если элемент - число
+*/
+static bool cbor_number(const uint8_t *p, double &value)
+{
+	uint8_t major = p[0] >> 5;
+	uint8_t ai = p[0] & 0x1f;
+	uint64_t arg = ai;
+	if ((ai >= 24) && (ai <= 27))
+	{
+		arg = 0;
+		for (size_t i = 0; i < (1U << (ai - 24)); i++)
+			arg = (arg << 8) | p[i + 1];
+	}
+	if (major == 0)
+	{
+		value = arg;
+	}
+	else if (major == 1)
+	{
+		value = -1.0 - arg;
+	}
+	else if ((major == 7) && (ai == 25))
+	{
+		int e = (arg >> 10) & 0x1f;
+		int m = arg & 0x3ff;
+		if (e == 0)
+			value = std::ldexp(m, -24);
+		else if (e != 31)
+			value = std::ldexp(m + 1024, e - 25);
+		else
+			value = (m == 0) ? INFINITY : NAN;
+		if ((arg & 0x8000) != 0)
+			value = -value;
+	}
+	else if ((major == 7) && (ai == 26))
+	{
+		uint32_t u = arg;
+		float f;
+		std::memcpy(&f, &u, sizeof(f));
+		value = f;
+	}
+	else if ((major == 7) && (ai == 27))
+	{
+		std::memcpy(&value, &arg, sizeof(value));
+	}
+	else
 		return false;
+	return true;
+}
 
-	int sz = std::strlen(name);
-	for (int i = beg; (i < (mRootSize - 1)) && (mRootTokens[beg].parent <= mRootTokens[i].parent); i++)
+std::string CJsonParser::unescape(const char *str, size_t len)
+{
+	std::string tmp;
+	tmp.reserve(len);
+	for (size_t i = 0; i < len; i++)
 	{
-		if (mRootTokens[beg].parent == mRootTokens[i].parent)
+		if ((str[i] != '\\') || ((i + 1) >= len))
 		{
-			if ((sz == (mRootTokens[i].end - mRootTokens[i].start)) && (std::memcmp(name, &mJson[mRootTokens[i].start], sz) == 0))
+			tmp.push_back(str[i]);
+			continue;
+		}
+		i++;
+		switch (str[i])
+		{
+		case 'b':
+			tmp.push_back('\b');
+			break;
+		case 'f':
+			tmp.push_back('\f');
+			break;
+		case 'n':
+			tmp.push_back('\n');
+			break;
+		case 'r':
+			tmp.push_back('\r');
+			break;
+		case 't':
+			tmp.push_back('\t');
+			break;
+		case 'u':
+		{
+			uint32_t cp = (i + 4 < len) ? std::strtoul(std::string(&str[i + 1], 4).c_str(), nullptr, 16) : 0xfffd;
+			i += 4;
+			if ((cp >= 0xd800) && (cp < 0xdc00) && (i + 6 < len) && (str[i + 1] == '\\') && (str[i + 2] == 'u'))
 			{
-				if ((mRootTokens[i + 1].type == JSMN_PRIMITIVE) && (mRootTokens[i + 1].parent == i))
+				uint32_t lo = std::strtoul(std::string(&str[i + 3], 4).c_str(), nullptr, 16);
+				if ((lo >= 0xdc00) && (lo < 0xe000))
 				{
-					if (mJson[mRootTokens[i + 1].start] == 'n')
-					{
-						return true;
-					}
+					cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+					i += 6;
 				}
 			}
+			if (cp < 0x80)
+			{
+				tmp.push_back(cp);
+			}
+			else if (cp < 0x800)
+			{
+				tmp.push_back(0xc0 | (cp >> 6));
+				tmp.push_back(0x80 | (cp & 0x3f));
+			}
+			else if (cp < 0x10000)
+			{
+				tmp.push_back(0xe0 | (cp >> 12));
+				tmp.push_back(0x80 | ((cp >> 6) & 0x3f));
+				tmp.push_back(0x80 | (cp & 0x3f));
+			}
+			else
+			{
+				tmp.push_back(0xf0 | (cp >> 18));
+				tmp.push_back(0x80 | ((cp >> 12) & 0x3f));
+				tmp.push_back(0x80 | ((cp >> 6) & 0x3f));
+				tmp.push_back(0x80 | (cp & 0x3f));
+			}
+			break;
+		}
+		default:
+			tmp.push_back(str[i]);
+			break;
 		}
 	}
-	return false;
+	return tmp;
+}
+
+std::string CJsonParser::escape(const std::string &str)
+{
+	static const char hex[] = "0123456789abcdef";
+	std::string res;
+	res.reserve(str.size());
+	for (char c : str)
+	{
+		switch (c)
+		{
+		case '"':
+			res += "\\\"";
+			break;
+		case '\\':
+			res += "\\\\";
+			break;
+		case '\b':
+			res += "\\b";
+			break;
+		case '\f':
+			res += "\\f";
+			break;
+		case '\n':
+			res += "\\n";
+			break;
+		case '\r':
+			res += "\\r";
+			break;
+		case '\t':
+			res += "\\t";
+			break;
+		default:
+			if ((uint8_t)c < 0x20)
+			{
+				res += "\\u00";
+				res += hex[(uint8_t)c >> 4];
+				res += hex[c & 0x0f];
+			}
+			else
+				res += c;
+			break;
+		}
+	}
+	return res;
 }
 
-bool CJsonParser::getObject(int beg, const char *name, int &value)
+/// Проверка числа json (RFC 8259).
+/*!
+  \param[in] str текст примитива.
+  \param[in] len длина текста.
+  \param[out] integer число без дробной части и экспоненты.
+  \return true, если текст - число
+*/
+static bool json_number(const char *str, size_t len, bool &integer)
 {
-	if (mJson.empty())
+	size_t i = 0;
+	if ((i < len) && (str[i] == '-'))
+		i++;
+	if ((i < len) && (str[i] == '0'))
+		i++;
+	else if ((i < len) && (str[i] >= '1') && (str[i] <= '9'))
+	{
+		while ((i < len) && std::isdigit((uint8_t)str[i]))
+			i++;
+	}
+	else
 		return false;
+	integer = (i == len);
+	if ((i < len) && (str[i] == '.'))
+	{
+		size_t d = ++i;
+		while ((i < len) && std::isdigit((uint8_t)str[i]))
+			i++;
+		if (i == d)
+			return false;
+	}
+	if ((i < len) && ((str[i] == 'e') || (str[i] == 'E')))
+	{
+		i++;
+		if ((i < len) && ((str[i] == '+') || (str[i] == '-')))
+			i++;
+		size_t d = i;
+		while ((i < len) && std::isdigit((uint8_t)str[i]))
+			i++;
+		if (i == d)
+			return false;
+	}
+	return i == len;
+}
 
-	int sz = std::strlen(name);
-	for (int i = beg; (i < (mRootSize - 1)) && (mRootTokens[beg].parent <= mRootTokens[i].parent); i++)
+/// Перевод событий разбора json в CBOR.
+/*!
+  Объекты и массивы кодируются с неопределенной длиной, escape-последовательности строк раскодируются.
+  Целые вне диапазона 64 бит кодируются как числа с плавающей точкой; примитив, не являющийся числом json,
+  и переполнение double прерывают разбор.
+*/
+class CCborWriter : public CJsonHandler
+{
+protected:
+	std::string *mOut; ///< Результат.
+
+	/// Заголовок элемента.
+	void head(uint8_t major, uint64_t arg)
+	{
+		major <<= 5;
+		if (arg < 24)
+		{
+			mOut->push_back(major | arg);
+			return;
+		}
+		int n;
+		if (arg <= 0xff)
+		{
+			mOut->push_back(major | 24);
+			n = 1;
+		}
+		else if (arg <= 0xffff)
+		{
+			mOut->push_back(major | 25);
+			n = 2;
+		}
+		else if (arg <= 0xffffffff)
+		{
+			mOut->push_back(major | 26);
+			n = 4;
+		}
+		else
+		{
+			mOut->push_back(major | 27);
+			n = 8;
+		}
+		for (int i = n - 1; i >= 0; i--)
+			mOut->push_back(arg >> (i * 8));
+	}
+	/// Текстовая строка.
+	void text(const char *str, size_t len)
+	{
+		std::string tmp = CJsonParser::unescape(str, len);
+		head(3, tmp.size());
+		mOut->append(tmp);
+	}
+
+public:
+	CCborWriter(std::string *out) : mOut(out) {};
+
+	bool onBeginObject() override
+	{
+		mOut->push_back(0xbf);
+		return true;
+	};
+	bool onEndObject() override
+	{
+		mOut->push_back(0xff);
+		return true;
+	};
+	bool onBeginArray() override
 	{
-		if (mRootTokens[beg].parent == mRootTokens[i].parent)
+		mOut->push_back(0x9f);
+		return true;
+	};
+	bool onEndArray() override
+	{
+		mOut->push_back(0xff);
+		return true;
+	};
+	bool onKey(const char *str, size_t len) override
+	{
+		text(str, len);
+		return true;
+	};
+	bool onString(const char *str, size_t len) override
+	{
+		text(str, len);
+		return true;
+	};
+	bool onNumber(const char *str, size_t len) override
+	{
+		bool integer;
+		if (!json_number(str, len, integer))
+			return false;
+		std::string tmp(str, len);
+		if (integer)
 		{
-			if ((sz == (mRootTokens[i].end - mRootTokens[i].start)) && (std::memcmp(name, &mJson[mRootTokens[i].start], sz) == 0))
+			// Целые вне 64 бит кодируются как числа с плавающей точкой.
+			errno = 0;
+			if (tmp[0] == '-')
+			{
+				long long v = std::strtoll(tmp.c_str(), nullptr, 10);
+				if (errno != ERANGE)
+				{
+					if (v >= 0)
+						head(0, v);
+					else
+						head(1, -1 - v);
+					return true;
+				}
+			}
+			else
 			{
-				if ((mRootTokens[i + 1].type == JSMN_OBJECT) && (mRootTokens[i + 1].parent == i) && (mRootTokens[i + 1].size > 0))
+				unsigned long long v = std::strtoull(tmp.c_str(), nullptr, 10);
+				if (errno != ERANGE)
 				{
-					value = i + 2;
+					head(0, v);
 					return true;
 				}
 			}
 		}
+		double d = std::strtod(tmp.c_str(), nullptr);
+		if (std::isinf(d))
+			return false;
+		float f = d;
+		if ((double)f == d)
+		{
+			uint32_t u;
+			std::memcpy(&u, &f, sizeof(u));
+			mOut->push_back(0xfa);
+			for (int i = 3; i >= 0; i--)
+				mOut->push_back(u >> (i * 8));
+		}
+		else
+		{
+			uint64_t u;
+			std::memcpy(&u, &d, sizeof(u));
+			mOut->push_back(0xfb);
+			for (int i = 7; i >= 0; i--)
+				mOut->push_back(u >> (i * 8));
+		}
+		return true;
+	};
+	bool onBool(bool value) override
+	{
+		mOut->push_back(value ? 0xf5 : 0xf4);
+		return true;
+	};
+	bool onNull() override
+	{
+		mOut->push_back(0xf6);
+		return true;
+	};
+};
+
+/// Каноническая форма json для сравнения значений (RFC 6902, операция test).
+/*!
+  CBOR с раскодированными строками, всеми числами в double и полями объектов, отсортированными по ключу.
+  Значения внутри корня (обрамляющего массива) подсчитываются.
+*/
+class CJsonCanon : public CCborWriter
+{
+protected:
+	/// Открытый объект: поля (ключ и значение) и вывод родителя.
+	struct SFrame
+	{
+		std::vector<std::string> members;
+		std::string *parent;
+	};
+	std::vector<SFrame> mStack; ///< Открытые объекты.
+	int mDepth = 0;				///< Глубина вложенности.
+	int mCount = 0;				///< Значений внутри корня.
+
+	/// Начало значения.
+	inline void value()
+	{
+		if (mDepth == 1)
+			mCount++;
 	}
-	return false;
+
+public:
+	using CCborWriter::CCborWriter;
+
+	/// Количество значений внутри корня.
+	inline int count() { return mCount; };
+
+	bool onBeginObject() override
+	{
+		value();
+		mDepth++;
+		mStack.push_back({{}, mOut});
+		return true;
+	};
+	bool onEndObject() override
+	{
+		mDepth--;
+		SFrame &f = mStack.back();
+		std::sort(f.members.begin(), f.members.end());
+		mOut = f.parent;
+		mOut->push_back(0xbf);
+		for (auto &m : f.members)
+			mOut->append(m);
+		mOut->push_back(0xff);
+		mStack.pop_back();
+		return true;
+	};
+	bool onBeginArray() override
+	{
+		value();
+		mDepth++;
+		return CCborWriter::onBeginArray();
+	};
+	bool onEndArray() override
+	{
+		mDepth--;
+		return CCborWriter::onEndArray();
+	};
+	bool onKey(const char *str, size_t len) override
+	{
+		mStack.back().members.emplace_back();
+		mOut = &mStack.back().members.back();
+		text(str, len);
+		return true;
+	};
+	bool onString(const char *str, size_t len) override
+	{
+		value();
+		return CCborWriter::onString(str, len);
+	};
+	bool onNumber(const char *str, size_t len) override
+	{
+		bool integer;
+		if (!json_number(str, len, integer))
+			return false;
+		value();
+		double d = std::strtod(std::string(str, len).c_str(), nullptr);
+		if (d == 0)
+			d = 0; // -0 == 0
+		uint64_t u;
+		std::memcpy(&u, &d, sizeof(u));
+		mOut->push_back(0xfb);
+		for (int i = 7; i >= 0; i--)
+			mOut->push_back(u >> (i * 8));
+		return true;
+	};
+	bool onBool(bool v) override
+	{
+		value();
+		return CCborWriter::onBool(v);
+	};
+	bool onNull() override
+	{
+		value();
+		return CCborWriter::onNull();
+	};
+};
+
+/// Каноническая форма одного значения json.
+/*!
+  \param[in] js json текст.
+  \param[in] len длина текста.
+  \param[out] canon каноническая форма.
+  \return true, если текст - ровно одно корректное значение
+*/
+static bool json_canon(const char *js, size_t len, std::string &canon)
+{
+	// Примитив верхнего уровня не имеет завершающего символа, поэтому разбор в массиве.
+	std::string wrap = "[" + std::string(js, len) + "]";
+	CJsonCanon h(&canon);
+	return CJsonParser::sax(wrap.c_str(), wrap.size(), &h) && (h.count() == 1);
+}
+
+#ifdef CONFIG_JSON_TOKENIZER_SWAR
+/// Токенизатор на основе swar_scan.
+/*!
+  Компактные токены строятся сразу, без промежуточной таблицы jsmn.
+  Для корректного JSON результат совпадает с jsmn.
+*/
+static int swar_parse(const char *js, size_t len, SJsonToken *tokens, unsigned int num, bool multi)
+{
+	STableBuilder builder(tokens, num);
+	int res = swar_scan(js, len, builder, multi);
+	return (res < 0) ? res : builder.count;
+}
+#else
+/// Проверка корневых элементов таблицы jsmn.
+/*!
+  jsmn без JSMN_STRICT пропускает запятые и лишние элементы на верхнем уровне;
+  между корневыми элементами и после них допускаются только пробелы, как в swar_scan.
+  \param[in] multi разрешить несколько корневых элементов подряд (NDJSON).
+  \return n, либо JSMN_ERROR_INVAL
+*/
+static int jsmn_roots(const char *js, size_t len, const jsmntok_t *src, int n, bool multi)
+{
+	size_t pos = 0;
+	int roots = 0;
+	for (int i = 0; i <= n; i++)
+	{
+		if ((i < n) && (src[i].parent != -1))
+			continue;
+		size_t start = (i < n) ? (src[i].start - ((src[i].type == JSMN_STRING) ? 1 : 0)) : len;
+		for (; pos < start; pos++)
+		{
+			if ((js[pos] != ' ') && (js[pos] != '\t') && (js[pos] != '\r') && (js[pos] != '\n'))
+				return JSMN_ERROR_INVAL;
+		}
+		if (i < n)
+		{
+			pos = src[i].end + ((src[i].type == JSMN_STRING) ? 1 : 0);
+			roots++;
+		}
+	}
+	return ((roots > 1) && !multi) ? JSMN_ERROR_INVAL : n;
+}
+
+/// Перевод таблицы jsmn в компактные токены.
+/*!
+  Поле size токена после проверки используется как индекс последнего дочернего ключа/элемента
+  (-1 - нет), поэтому таблица src портится.
+  \return количество токенов, либо JSMN_ERROR_INVAL
+*/
+static int jsmn_convert(jsmntok_t *src, int n, SJsonToken *tokens)
+{
+	int root = -1;
+	for (int i = 0; i < n; i++)
+	{
+		EJsonType type;
+		switch (src[i].type)
+		{
+		case JSMN_OBJECT:
+			type = JSON_OBJECT;
+			break;
+		case JSMN_ARRAY:
+			type = JSON_ARRAY;
+			break;
+		case JSMN_STRING:
+			type = JSON_STRING;
+			break;
+		default:
+			type = JSON_PRIMITIVE;
+			break;
+		}
+		set_token(&tokens[i], type, src[i].start, src[i].end);
+
+		int p = src[i].parent;
+		if ((p != -1) && (src[p].type == JSMN_OBJECT))
+		{
+			if ((src[i].size != 1) || (type == JSON_OBJECT) || (type == JSON_ARRAY))
+				return JSMN_ERROR_INVAL;
+		}
+		src[i].size = -1;
+		if (p == -1)
+		{
+			if (root != -1)
+				link_token(tokens, root, i);
+			root = i;
+			continue;
+		}
+		if ((src[p].type != JSMN_OBJECT) && (src[p].type != JSMN_ARRAY))
+			continue;
+		if (src[p].size != -1)
+			link_token(tokens, src[p].size, i);
+		src[p].size = i;
+	}
+	return n;
 }
+#endif // CONFIG_JSON_TOKENIZER_SWAR
 
-bool CJsonParser::getInt(int beg, const char *name, int &value)
+/// Следующий сегмент пути JSON Pointer.
+/*!
+  \param[in] path путь.
+  \param[in,out] pos позиция '/' перед сегментом, после вызова - позиция следующего '/' либо конец пути.
+  \param[out] seg сегмент с раскодированными ~0 и ~1.
+  \return true в случае успеха
+*/
+static bool pointer_segment(const std::string &path, size_t &pos, std::string &seg)
 {
-	if (mJson.empty())
+	if ((pos >= path.size()) || (path[pos] != '/'))
 		return false;
+	size_t end = path.find('/', pos + 1);
+	if (end == std::string::npos)
+		end = path.size();
+	seg.clear();
+	for (size_t i = pos + 1; i < end; i++)
+	{
+		if ((path[i] == '~') && ((i + 1) < end) && ((path[i + 1] == '0') || (path[i + 1] == '1')))
+		{
+			seg += (path[i + 1] == '0') ? '~' : '/';
+			i++;
+		}
+		else
+			seg += path[i];
+	}
+	pos = end;
+	return true;
+}
+
+/// Сравнение ключа объекта с раскодированным сегментом пути.
+/*!
+  \param[in] str текст ключа в json (с escape-последовательностями).
+  \param[in] len длина текста.
+  \param[in] seg сегмент пути.
+  \param[in] raw ключ без escape-последовательностей (CBOR).
+  \return true, если раскодированный ключ равен сегменту
+*/
+static bool pointer_key(const char *str, size_t len, const std::string &seg, bool raw)
+{
+	if (raw || (std::memchr(str, '\\', len) == nullptr))
+		return (len == seg.size()) && (std::memcmp(str, seg.c_str(), len) == 0);
+	return CJsonParser::unescape(str, len) == seg;
+}
+
+/// Индекс элемента массива из сегмента пути.
+/*!
+  \return индекс, либо -1
+*/
+static int pointer_index(const std::string &seg)
+{
+	if (seg.empty() || (seg.size() > 9))
+		return -1;
+	for (char c : seg)
+	{
+		if ((c < '0') || (c > '9'))
+			return -1;
+	}
+	return std::atoi(seg.c_str());
+}
+
+CJsonParser::CJsonParser() : mRootTokensSize(CONFIG_JSON_MIN_TOKEN_SIZE)
+{
+	mRootTokens = new SJsonToken[mRootTokensSize];
+	mKeyHashes = new uint8_t[mRootTokensSize];
+#ifndef CONFIG_JSON_TOKENIZER_SWAR
+	mJsmnTokens = new jsmntok_t[mRootTokensSize];
+#endif
+}
+
+CJsonParser::~CJsonParser()
+{
+	delete[] mRootTokens;
+	delete[] mKeyHashes;
+	delete[] mJsmnTokens;
+}
+
+int CJsonParser::tokenize(const char *json, size_t len, SJsonToken *tokens, unsigned int num, bool multi)
+{
+#ifdef CONFIG_JSON_TOKENIZER_SWAR
+	return swar_parse(json, len, tokens, num, multi);
+#else
+	jsmn_init(&mParser);
+	if (tokens == nullptr)
+		return jsmn_parse(&mParser, json, len, nullptr, 0);
+	if (num > (unsigned int)mRootTokensSize)
+		return JSMN_ERROR_NOMEM;
+	int res = jsmn_parse(&mParser, json, len, mJsmnTokens, num);
+	if (res > 0)
+		res = jsmn_roots(json, len, mJsmnTokens, res, multi);
+	if (res > 0)
+		res = jsmn_convert(mJsmnTokens, res, tokens);
+	return res;
+#endif
+}
+
+bool CJsonParser::resize(int num)
+{
+	delete[] mRootTokens;
+	delete[] mKeyHashes;
+	delete[] mJsmnTokens;
+	mRootTokensSize = num;
+	mRootTokens = new SJsonToken[mRootTokensSize];
+	mKeyHashes = new uint8_t[mRootTokensSize];
+#ifndef CONFIG_JSON_TOKENIZER_SWAR
+	mJsmnTokens = new jsmntok_t[mRootTokensSize];
+#else
+	mJsmnTokens = nullptr;
+#endif
+	return true;
+}
+
+int CJsonParser::parse(const char *json)
+{
+	return parse(json, false);
+}
+
+int CJsonParser::parseBatch(const char *json)
+{
+	if (parse(json, true) != 1)
+		return -1;
+	int n = 0;
+	for (int i = mBatch; i != -1; i = next(i))
+		n++;
+	return n;
+}
+
+int CJsonParser::parse(const char *json, bool batch)
+{
+	mJson.clear();
+	mCbor = false;
+
+	size_t len = std::strlen(json);
+	if (len > 0xffffff)
+	{
+		ESP_LOGE(TAG, "JSON string is too long");
+		return -1;
+	}
+	mRootSize = tokenize(json, len, mRootTokens, mRootTokensSize, batch);
+	if (mRootSize == JSMN_ERROR_NOMEM)
+	{
+		int n = tokenize(json, len, nullptr, 0, batch);
+		if (n > 0)
+		{
+			resize(n + 1);
+			mRootSize = tokenize(json, len, mRootTokens, mRootTokensSize, batch);
+		}
+		else
+			mRootSize = n;
+	}
+	return result(json, len, batch);
+}
+
+int CJsonParser::parseCbor(const uint8_t *data, size_t size)
+{
+	mJson.clear();
+	mCbor = true;
 
-	int sz = std::strlen(name);
-	for (int i = beg; (i < (mRootSize - 1)) && (mRootTokens[beg].parent <= mRootTokens[i].parent); i++)
+	if (size > 0xffffff)
+	{
+		ESP_LOGE(TAG, "CBOR data is too long");
+		return -1;
+	}
+	mRootSize = cbor_parse(data, size, mRootTokens, mRootTokensSize);
+	if (mRootSize == JSMN_ERROR_NOMEM)
+	{
+		int n = cbor_parse(data, size, nullptr, 0);
+		if (n > 0)
+		{
+			resize(n + 1);
+			mRootSize = cbor_parse(data, size, mRootTokens, mRootTokensSize);
+		}
+		else
+			mRootSize = n;
+	}
+	return result((const char *)data, size, false);
+}
+
+int CJsonParser::result(const char *data, size_t len, bool batch)
+{
+	mBatch = -1;
+	if (mRootSize < 0)
+	{
+		if (mRootSize == JSMN_ERROR_INVAL)
+		{
+			ESP_LOGE(TAG, "bad token, JSON string is corrupted");
+		}
+		else if (mRootSize == JSMN_ERROR_PART)
+		{
+			ESP_LOGE(TAG, "JSON string is too short");
+		}
+		else
+		{
+			ESP_LOGE(TAG, "JSON string error");
+		}
+		return -1;
+	}
+	if (batch && (mRootSize > 0))
 	{
-		if (mRootTokens[beg].parent == mRootTokens[i].parent)
+		// Массив команд, либо команды подряд (NDJSON).
+		if (mRootTokens[0].type == JSON_OBJECT)
+			mBatch = 0;
+		else if ((mRootTokens[0].type == JSON_ARRAY) && (size(0) > 0))
 		{
-			if ((sz == (mRootTokens[i].end - mRootTokens[i].start)) && (std::memcmp(name, &mJson[mRootTokens[i].start], sz) == 0))
+			if (next(0) != -1)
 			{
-				if ((mRootTokens[i + 1].type == JSMN_PRIMITIVE) && (mRootTokens[i + 1].parent == i))
-				{
-					std::string str = mJson.substr(mRootTokens[i + 1].start, mRootTokens[i + 1].end - mRootTokens[i + 1].start);
-					value = std::atoi((const char *)str.c_str());
-					return true;
-				}
+				ESP_LOGE(TAG, "batch array must be the only root");
+				return 0;
 			}
+			mBatch = 1;
+		}
+	}
+	if ((mBatch != -1) || ((mRootSize > 1) && (mRootTokens[0].type == JSON_OBJECT)))
+	{
+		for (int i = 0; i < mRootSize; i++)
+		{
+			if ((mRootTokens[i].type == JSON_OBJECT) && (i + 1 < mRootSize) && (mRootTokens[i + 1].start < (mRootTokens[i].start + mRootTokens[i].len)))
+			{
+				for (int j = i + 1; j != -1; j = next(j))
+					mKeyHashes[j] = SJsonKey::calcHash(&data[mRootTokens[j].start], mRootTokens[j].len);
+			}
+		}
+		mJson.assign(data, len);
+		return 1;
+	}
+	else
+	{
+		ESP_LOGE(TAG, "root error");
+		return 0;
+	}
+}
+
+bool CJsonParser::toCbor(const char *json, size_t len, std::string &cbor)
+{
+	cbor.clear();
+	CCborWriter writer(&cbor);
+	return sax(json, len, &writer);
+}
+
+std::string CJsonParser::runBatch(std::function<std::string(int beg)> handler)
+{
+	std::string answer = "[";
+	bool point = false;
+	for (int i = mBatch; i != -1; i = next(i))
+	{
+		if (point)
+			answer += ',';
+		else
+			point = true;
+		int beg;
+		if (mRootTokens[i].type != JSON_OBJECT)
+		{
+			answer += "{\"error\":\"command is not an object\"}";
+		}
+		else if (!getFirst(i, JSON_OBJECT, beg))
+		{
+			answer += "{\"error\":\"empty command\"}";
+		}
+		else
+		{
+			std::string str = handler(beg);
+			if (str.empty())
+				answer += "{\"error\":\"unknown command\"}";
+			else
+				answer += "{" + str + "}";
+		}
+	}
+	answer += ']';
+	return answer;
+}
+
+bool CJsonParser::sax(const char *json, size_t len, CJsonHandler *handler)
+{
+	SSaxAdapter adapter;
+	adapter.handler = handler;
+	adapter.js = json;
+	int res = swar_scan(json, len, adapter);
+	if (res == JSMN_ERROR_INVAL)
+	{
+		ESP_LOGE(TAG, "bad token, JSON string is corrupted");
+	}
+	else if (res == JSMN_ERROR_PART)
+	{
+		ESP_LOGE(TAG, "JSON string is too short");
+	}
+	return (res == 0);
+}
+
+int CJsonParser::next(int i)
+{
+	int n = mRootTokens[i].next;
+	if (n == 0)
+		return -1;
+	if (n != JSON_TOKEN_FAR)
+		return i + n;
+
+	// Ключ объекта - только строка или примитив, пропускаем его значение.
+	if ((mRootTokens[i].type != JSON_OBJECT) && (mRootTokens[i].type != JSON_ARRAY))
+		i++;
+	uint32_t end = mRootTokens[i].start + mRootTokens[i].len;
+	for (n = i + 1; (n < mRootSize) && (mRootTokens[n].start < end); n++)
+		;
+	return n;
+}
+
+int CJsonParser::size(int i)
+{
+	if ((i + 1 >= mRootSize) || (mRootTokens[i + 1].start >= (mRootTokens[i].start + mRootTokens[i].len)))
+		return 0;
+	int n = 0;
+	for (int j = i + 1; j != -1; j = next(j))
+		n++;
+	return n;
+}
+
+int CJsonParser::find(int beg, const SJsonKey &name)
+{
+	if (mJson.empty() || (beg <= 0) || (beg >= (mRootSize - 1)))
+		return -1;
+
+	for (int i = beg; i != -1; i = next(i))
+	{
+		if ((mKeyHashes[i] == name.hash) && (name.len == mRootTokens[i].len) && (std::memcmp(name.name, &mJson[mRootTokens[i].start], name.len) == 0))
+			return i + 1;
+	}
+	return -1;
+}
+
+bool CJsonParser::getValue(int i, SJsonField::EKind kind, void *value)
+{
+	if (mJson.empty() || (i <= 0) || (i >= mRootSize))
+		return false;
+
+	const SJsonToken &tok = mRootTokens[i];
+	if (mCbor && (tok.type == JSON_PRIMITIVE))
+	{
+		const uint8_t *p = (const uint8_t *)&mJson[tok.start];
+		double d;
+		switch (kind)
+		{
+		case SJsonField::NONE:
+			return (p[0] == 0xf6);
+		case SJsonField::INT:
+			if (!cbor_number(p, d) || !((d >= INT_MIN) && (d <= INT_MAX)))
+				return false;
+			*(int *)value = (int)d;
+			return true;
+		case SJsonField::FLOAT:
+			if (!cbor_number(p, d))
+				return false;
+			*(float *)value = d;
+			return true;
+		case SJsonField::BOOL:
+			if ((p[0] != 0xf4) && (p[0] != 0xf5))
+				return false;
+			*(bool *)value = (p[0] == 0xf5);
+			return true;
+		default:
+			return false;
 		}
 	}
+	switch (kind)
+	{
+	case SJsonField::NONE:
+		return (tok.type == JSON_PRIMITIVE) && (mJson[tok.start] == 'n');
+	case SJsonField::STRING:
+		if (tok.type != JSON_STRING)
+			return false;
+		*(std::string *)value = mJson.substr(tok.start, tok.len);
+		return true;
+	case SJsonField::INT:
+		if (tok.type != JSON_PRIMITIVE)
+			return false;
+		*(int *)value = std::atoi(&mJson[tok.start]);
+		return true;
+	case SJsonField::FLOAT:
+		if (tok.type != JSON_PRIMITIVE)
+			return false;
+		*(float *)value = std::atof(&mJson[tok.start]);
+		return true;
+	case SJsonField::BOOL:
+		if ((tok.type != JSON_PRIMITIVE) || ((mJson[tok.start] != 't') && (mJson[tok.start] != 'f')))
+			return false;
+		*(bool *)value = (mJson[tok.start] == 't');
+		return true;
+	}
 	return false;
 }
 
-bool CJsonParser::getFloat(int beg, const char *name, float &value)
+bool CJsonParser::getFirst(int i, EJsonType type, int &value)
 {
-	if (mJson.empty())
+	if (mJson.empty() || (i < 0) || (i >= mRootSize) || (mRootTokens[i].type != type) || (size(i) == 0))
 		return false;
+	value = i + 1;
+	return true;
+}
+
+uint32_t CJsonParser::getMany(int beg, std::initializer_list<SJsonField> fields)
+{
+	if (mJson.empty() || (beg <= 0) || (beg >= (mRootSize - 1)))
+		return 0;
 
-	int sz = std::strlen(name);
-	for (int i = beg; (i < (mRootSize - 1)) && (mRootTokens[beg].parent <= mRootTokens[i].parent); i++)
+	uint32_t res = 0;
+	uint32_t all = (fields.size() >= 32) ? 0xffffffff : ((1UL << fields.size()) - 1);
+	for (int i = beg; (i != -1) && (res != all); i = next(i))
 	{
-		if (mRootTokens[beg].parent == mRootTokens[i].parent)
+		uint32_t bit = 1;
+		for (const SJsonField &field : fields)
 		{
-			if ((sz == (mRootTokens[i].end - mRootTokens[i].start)) && (std::memcmp(name, &mJson[mRootTokens[i].start], sz) == 0))
+			if (((res & bit) == 0) && (mKeyHashes[i] == field.key.hash) && (field.key.len == mRootTokens[i].len) && (std::memcmp(field.key.name, &mJson[mRootTokens[i].start], field.key.len) == 0))
 			{
-				if ((mRootTokens[i + 1].type == JSMN_PRIMITIVE) && (mRootTokens[i + 1].parent == i))
-				{
-					std::string str = mJson.substr(mRootTokens[i + 1].start, mRootTokens[i + 1].end - mRootTokens[i + 1].start);
-					value = std::atof((const char *)str.c_str());
-					return true;
-				}
+				if (getValue(i + 1, field.kind, field.value))
+					res |= bit;
+				break;
 			}
+			bit <<= 1;
 		}
 	}
-	return false;
+	return res;
 }
 
-bool CJsonParser::getBool(int beg, const char *name, bool &value)
+bool CJsonParser::getString(int beg, const SJsonKey &name, std::string &value)
 {
-	if (mJson.empty())
-		return false;
+	int i = find(beg, name);
+	return (i != -1) && getValue(i, SJsonField::STRING, &value);
+}
+
+bool CJsonParser::getField(int beg, const SJsonKey &name)
+{
+	int i = find(beg, name);
+	return (i != -1) && getValue(i, SJsonField::NONE, nullptr);
+}
+
+bool CJsonParser::getObject(int beg, const SJsonKey &name, int &value)
+{
+	int i = find(beg, name);
+	return (i != -1) && getFirst(i, JSON_OBJECT, value);
+}
+
+bool CJsonParser::getArray(int beg, const SJsonKey &name, int &value)
+{
+	int i = find(beg, name);
+	return (i != -1) && getFirst(i, JSON_ARRAY, value);
+}
+
+CJsonRange<std::pair<int, int>> CJsonParser::members(int beg)
+{
+	return CJsonRange<std::pair<int, int>>(this, (mJson.empty() || (beg <= 0) || (beg >= (mRootSize - 1))) ? -1 : beg);
+}
+
+CJsonRange<int> CJsonParser::elements(int beg)
+{
+	return CJsonRange<int>(this, (mJson.empty() || (beg <= 0) || (beg >= mRootSize)) ? -1 : beg);
+}
+
+bool CJsonParser::getInt(int beg, const SJsonKey &name, int &value)
+{
+	int i = find(beg, name);
+	return (i != -1) && getValue(i, SJsonField::INT, &value);
+}
+
+bool CJsonParser::getFloat(int beg, const SJsonKey &name, float &value)
+{
+	int i = find(beg, name);
+	return (i != -1) && getValue(i, SJsonField::FLOAT, &value);
+}
+
+bool CJsonParser::getBool(int beg, const SJsonKey &name, bool &value)
+{
+	int i = find(beg, name);
+	return (i != -1) && getValue(i, SJsonField::BOOL, &value);
+}
 
-	int sz = std::strlen(name);
-	for (int i = beg; (i < (mRootSize - 1)) && (mRootTokens[beg].parent <= mRootTokens[i].parent); i++)
+bool CJsonParser::getArrayInt(int beg, const SJsonKey &name, int *&data, int &size)
+{
+	int i = find(beg, name);
+	if ((i != -1) && (mRootTokens[i].type == JSON_ARRAY))
 	{
-		if (mRootTokens[beg].parent == mRootTokens[i].parent)
+		size = this->size(i);
+		if (size > 0)
 		{
-			if ((sz == (mRootTokens[i].end - mRootTokens[i].start)) && (std::memcmp(name, &mJson[mRootTokens[i].start], sz) == 0))
+			data = new int[size];
+			int j = i + 1;
+			for (int k = 0; k < size; k++, j = next(j))
 			{
-				if ((mRootTokens[i + 1].type == JSMN_PRIMITIVE) && (mRootTokens[i + 1].parent == i))
-				{
-					if (mJson[mRootTokens[i + 1].start] == 'f')
-					{
-						value = false;
-						return true;
-					}
-					else if (mJson[mRootTokens[i + 1].start] == 't')
-					{
-						value = true;
-						return true;
-					}
-				}
+				if (!getValue(j, SJsonField::INT, &data[k]))
+					data[k] = 0;
 			}
+			return true;
 		}
 	}
 	return false;
 }
 
-bool CJsonParser::getArrayInt(int beg, const char *name, int *&data, int &size)
+bool CJsonParser::getText(int i, std::string &value)
 {
-	if (mJson.empty())
+	if (mJson.empty() || mCbor || (i < 0) || (i >= mRootSize))
 		return false;
+	value = mJson.substr(spanStart(i), spanEnd(i) - spanStart(i));
+	return true;
+}
+
+bool CJsonParser::getText(int beg, const SJsonKey &name, std::string &value)
+{
+	int i = find(beg, name);
+	return (i != -1) && getText(i, value);
+}
+
+int CJsonParser::findPath(const std::string &path)
+{
+	if (mJson.empty() || (mRootSize <= 0))
+		return -1;
+
+	int i = 0;
+	size_t pos = 0;
+	std::string seg;
+	while (pos < path.size())
+	{
+		if (!pointer_segment(path, pos, seg))
+			return -1;
+		int first;
+		if (getFirst(i, JSON_OBJECT, first))
+		{
+			for (i = first; (i != -1) && !pointer_key(&mJson[mRootTokens[i].start], mRootTokens[i].len, seg, mCbor); i = next(i))
+				;
+			if (i != -1)
+				i++;
+		}
+		else if (getFirst(i, JSON_ARRAY, first))
+		{
+			int n = pointer_index(seg);
+			for (i = first; (i != -1) && (n > 0); n--)
+				i = next(i);
+			if (n < 0)
+				i = -1;
+		}
+		else
+			i = -1;
+		if (i == -1)
+			return -1;
+	}
+	return i;
+}
+
+std::string CJsonParser::patch(const std::string &op, const std::string &path, const std::string &value, std::string &result)
+{
+	if (mJson.empty() || mCbor)
+		return "json wasn't parsed";
+	std::string canon;
+	if ((op != "remove") && !json_canon(value.c_str(), value.size(), canon))
+		return "bad value";
+	std::string other;
+	if (path.empty())
+	{
+		if ((op == "add") || (op == "replace"))
+		{
+			result = value;
+			return "";
+		}
+		else if (op == "test")
+		{
+			result = mJson;
+			return (json_canon(mJson.c_str(), mJson.size(), other) && (other == canon)) ? "" : "test failed";
+		}
+		return "wrong op " + op + " for root";
+	}
 
-	int sz = std::strlen(name);
-	for (int i = beg; (i < (mRootSize - 1)) && (mRootTokens[beg].parent <= mRootTokens[i].parent); i++)
+	size_t pos = path.rfind('/');
+	if (pos == std::string::npos)
+		return "bad path " + path;
+	int parent = findPath(path.substr(0, pos));
+	std::string last;
+	if ((parent == -1) || !pointer_segment(path, pos, last))
+		return "path not found " + path;
+	bool obj = (mRootTokens[parent].type == JSON_OBJECT);
+	if (!obj && (mRootTokens[parent].type != JSON_ARRAY))
+		return "path not found " + path;
+
+	// Поиск ключа объекта либо элемента массива, prev - предыдущий сосед.
+	int n = obj ? -1 : pointer_index(last);
+	int cur = -1;
+	int prev = -1;
+	int count = 0;
+	int first;
+	if (getFirst(parent, obj ? JSON_OBJECT : JSON_ARRAY, first))
 	{
-		if (mRootTokens[beg].parent == mRootTokens[i].parent)
+		for (int i = first; i != -1; prev = i, i = next(i), count++)
 		{
-			if ((sz == (mRootTokens[i].end - mRootTokens[i].start)) && (std::memcmp(name, &mJson[mRootTokens[i].start], sz) == 0))
+			if (obj ? pointer_key(&mJson[mRootTokens[i].start], mRootTokens[i].len, last, false) : (count == n))
 			{
-				if ((mRootTokens[i + 1].type == JSMN_ARRAY) && (mRootTokens[i + 1].parent == i) && (mRootTokens[i + 1].size > 0))
-				{
-					size = mRootTokens[i + 1].size;
-					data = new int[size];
-					for (int j = 0; j < size; j++)
-					{
-						std::string str = mJson.substr(mRootTokens[j + i + 2].start, mRootTokens[j + i + 2].end - mRootTokens[j + i + 2].start);
-						data[j] = std::atoi((const char *)str.c_str());
-					}
-					return true;
-				}
+				cur = i;
+				break;
 			}
 		}
 	}
-	return false;
+	int val = obj ? (cur + 1) : cur;
+
+	result = mJson;
+	if (op == "test")
+	{
+		if (cur == -1)
+			return "path not found " + path;
+		if (!json_canon(&mJson[spanStart(val)], spanEnd(val) - spanStart(val), other) || (other != canon))
+			return "test failed " + path;
+	}
+	else if (op == "remove")
+	{
+		if (cur == -1)
+			return "path not found " + path;
+		uint32_t s = spanStart(cur);
+		uint32_t e = spanEnd(val);
+		int nx = next(cur);
+		if (nx != -1)
+			e = spanStart(nx);
+		else if (prev != -1)
+			s = spanEnd(obj ? (prev + 1) : prev);
+		result.erase(s, e - s);
+	}
+	else if ((op == "replace") || ((op == "add") && obj && (cur != -1)))
+	{
+		if (cur == -1)
+			return "path not found " + path;
+		result.replace(spanStart(val), spanEnd(val) - spanStart(val), value);
+	}
+	else if (op == "add")
+	{
+		std::string item = value;
+		if (obj)
+			item = "\"" + escape(last) + "\":" + value;
+		if (cur != -1)
+			result.insert(spanStart(cur), item + ",");
+		else if (obj || (last == "-") || (n == count))
+			result.insert(spanEnd(parent) - 1, ((count > 0) ? "," : "") + item);
+		else
+			return "path not found " + path;
+	}
+	else
+		return "wrong op " + op;
+	return "";
+}
+
+bool CJsonParser::replace(const std::vector<std::pair<int, std::string>> &values, std::string &result)
+{
+	if (mJson.empty() || mCbor)
+		return false;
+	result.clear();
+	result.reserve(mJson.size());
+	uint32_t pos = 0;
+	for (auto &[i, text] : values)
+	{
+		if ((i <= 0) || (i >= mRootSize) || (mRootTokens[i].type == JSON_OBJECT) || (mRootTokens[i].type == JSON_ARRAY) || (spanStart(i) < pos))
+			return false;
+		result.append(mJson, pos, spanStart(i) - pos);
+		result += text;
+		pos = spanEnd(i);
+	}
+	result.append(mJson, pos, std::string::npos);
+	return true;
 }
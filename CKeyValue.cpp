@@ -0,0 +1,304 @@
+/*!
+    \file
+    \brief Класс хранилища ключ-значение в SPIFFS.
+    \authors Близнец Р.А. (r.bliznets@gmail.com)
+    \version 0.1.0.0
+    \date 17.10.2026
+*/
+
+#include "CKeyValue.h"
+#include "CSpiffsSystem.h"
+#include "esp_rom_crc.h"
+#include "esp_log.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cinttypes>
+#include <sys/stat.h>
+
+static const char *TAG = "kv";
+
+uint32_t CKeyValue::hash(const std::string &key)
+{
+    uint32_t h = 2166136261UL;
+    for (char c : key)
+    {
+        h ^= (uint8_t)c;
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+bool CKeyValue::load()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mIndex.clear();
+    mSize = 0;
+    mGarbage = 0;
+    mLoaded = true;
+    FILE *f = std::fopen(CSpiffsSystem::path(mFileName).c_str(), "r");
+    if (f == nullptr)
+        return true;
+
+    std::fseek(f, 0, SEEK_END);
+    uint32_t end = std::ftell(f);
+    std::fseek(f, 0, SEEK_SET);
+    uint8_t head[KV_HEADER_SIZE];
+    std::string data;
+    // Ключи и размеры записей индекса (в том же порядке) - повторный ключ находится без чтения файла.
+    std::vector<std::pair<std::string, uint32_t>> keys;
+    while ((mSize + KV_HEADER_SIZE) <= end)
+    {
+        if (std::fread(head, 1, KV_HEADER_SIZE, f) != KV_HEADER_SIZE)
+            break;
+        uint16_t vlen;
+        uint32_t crc;
+        std::memcpy(&vlen, &head[2], 2);
+        std::memcpy(&crc, &head[4], 4);
+        uint32_t len = head[1] + ((vlen == KV_DELETED) ? 0 : vlen);
+        data.resize(len);
+        if ((head[0] != KV_MAGIC) || (std::fread(data.data(), 1, len, f) != len) ||
+            (esp_rom_crc32_le(0, (const uint8_t *)data.data(), len) != crc))
+            break;
+
+        std::string key = data.substr(0, head[1]);
+        uint32_t h = hash(key);
+        size_t i = std::lower_bound(mIndex.begin(), mIndex.end(), std::make_pair(h, (uint32_t)0)) - mIndex.begin();
+        for (; (i < mIndex.size()) && (mIndex[i].first == h); i++)
+        {
+            if (keys[i].first == key)
+            {
+                mGarbage += keys[i].second;
+                mIndex.erase(mIndex.begin() + i);
+                keys.erase(keys.begin() + i);
+                break;
+            }
+        }
+        if (vlen == KV_DELETED)
+            mGarbage += KV_HEADER_SIZE + len;
+        else
+        {
+            auto item = std::make_pair(h, mSize);
+            auto it = std::upper_bound(mIndex.begin(), mIndex.end(), item);
+            keys.insert(keys.begin() + (it - mIndex.begin()), std::make_pair(key, KV_HEADER_SIZE + len));
+            mIndex.insert(it, item);
+        }
+        mSize += KV_HEADER_SIZE + len;
+    }
+    std::fclose(f);
+
+    if (mSize != end)
+    {
+        ESP_LOGW(TAG, "File %s is corrupted at %" PRIu32, mFileName.c_str(), mSize);
+        mGarbage += end - mSize;
+        mSize = end;
+        // Пока повреждённый конец не удалён, новые записи после него были бы потеряны.
+        mLoaded = compactFile();
+        return mLoaded;
+    }
+    ESP_LOGI(TAG, "%s: keys %zu, size %" PRIu32 ", garbage %" PRIu32, mFileName.c_str(), mIndex.size(), mSize, mGarbage);
+    return true;
+}
+
+int CKeyValue::find(const std::string &key, std::string *value, uint32_t &size)
+{
+    uint32_t h = hash(key);
+    auto it = std::lower_bound(mIndex.begin(), mIndex.end(), std::make_pair(h, (uint32_t)0));
+    if ((it == mIndex.end()) || (it->first != h))
+        return -1;
+    FILE *f = std::fopen(CSpiffsSystem::path(mFileName).c_str(), "r");
+    if (f == nullptr)
+        return -1;
+    // Разные ключи с одинаковым хэшем различаются по ключу в записи.
+    int res = -1;
+    uint8_t head[KV_HEADER_SIZE];
+    for (; (it != mIndex.end()) && (it->first == h); it++)
+    {
+        std::fseek(f, it->second, SEEK_SET);
+        if (std::fread(head, 1, KV_HEADER_SIZE, f) != KV_HEADER_SIZE)
+            continue;
+        uint16_t vlen;
+        std::memcpy(&vlen, &head[2], 2);
+        std::string data(head[1] + vlen, '\0');
+        if ((head[1] != key.size()) || (std::fread(data.data(), 1, data.size(), f) != data.size()) || (data.compare(0, key.size(), key) != 0))
+            continue;
+        if (value != nullptr)
+            *value = data.substr(key.size());
+        size = KV_HEADER_SIZE + data.size();
+        res = it - mIndex.begin();
+        break;
+    }
+    std::fclose(f);
+    return res;
+}
+
+bool CKeyValue::append(const std::string &key, const std::string *value)
+{
+    uint16_t vlen = (value == nullptr) ? KV_DELETED : value->size();
+    std::string data = key;
+    if (value != nullptr)
+        data += *value;
+    uint8_t head[KV_HEADER_SIZE];
+    head[0] = KV_MAGIC;
+    head[1] = key.size();
+    std::memcpy(&head[2], &vlen, 2);
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)data.data(), data.size());
+    std::memcpy(&head[4], &crc, 4);
+
+    CSpiffsSystem::invalidate(mFileName);
+    FILE *f = std::fopen(CSpiffsSystem::path(mFileName).c_str(), "a");
+    if (f == nullptr)
+    {
+        ESP_LOGW(TAG, "Failed to open file %s", mFileName.c_str());
+        return false;
+    }
+    // Запись одним fwrite, чтобы прерванная запись была только в конце файла.
+    data.insert(0, (const char *)head, KV_HEADER_SIZE);
+    bool res = (std::fwrite(data.data(), 1, data.size(), f) == data.size());
+    res &= (std::fclose(f) == 0);
+    if (res)
+    {
+        mSize += data.size();
+        return true;
+    }
+    // Часть записи могла попасть в файл: load() остановится на ней и потеряет следующие записи,
+    // поэтому размер файла перечитывается и хвост удаляется уплотнением.
+    ESP_LOGW(TAG, "Failed to write to file %s", mFileName.c_str());
+    struct stat st;
+    if ((stat(CSpiffsSystem::path(mFileName).c_str(), &st) == 0) && ((uint32_t)st.st_size != mSize))
+    {
+        mGarbage += st.st_size - mSize;
+        mSize = st.st_size;
+        if (!compactFile())
+            mLoaded = false;
+    }
+    return false;
+}
+
+bool CKeyValue::get(const std::string &key, std::string &value)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    uint32_t size;
+    return find(key, &value, size) != -1;
+}
+
+bool CKeyValue::put(const std::string &key, const std::string &value)
+{
+    if (key.empty() || (key.size() > 255) || (value.size() >= KV_DELETED))
+        return false;
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mLoaded)
+        return false;
+    uint32_t size;
+    int i = find(key, nullptr, size);
+    uint32_t offset = mSize;
+    if (!append(key, &value))
+        return false;
+    if (i != -1)
+    {
+        mGarbage += size;
+        mIndex[i].second = offset;
+    }
+    else
+    {
+        auto item = std::make_pair(hash(key), offset);
+        mIndex.insert(std::upper_bound(mIndex.begin(), mIndex.end(), item), item);
+    }
+    check();
+    return true;
+}
+
+bool CKeyValue::del(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mLoaded)
+        return false;
+    uint32_t size;
+    int i = find(key, nullptr, size);
+    if ((i == -1) || !append(key, nullptr))
+        return false;
+    mGarbage += size + KV_HEADER_SIZE + key.size();
+    mIndex.erase(mIndex.begin() + i);
+    check();
+    return true;
+}
+
+void CKeyValue::check()
+{
+    if ((mGarbage > CONFIG_KV_COMPACT_SIZE) && (mGarbage > (mSize - mGarbage)))
+        compactFile();
+}
+
+bool CKeyValue::compact()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return compactFile();
+}
+
+bool CKeyValue::compactFile()
+{
+    std::string str = CSpiffsSystem::path(mFileName);
+    if ((mSize == 0) && mIndex.empty())
+        return true;
+    FILE *f = std::fopen(str.c_str(), "r");
+    FILE *out = std::fopen((str + '$').c_str(), "w");
+    if ((f == nullptr) || (out == nullptr))
+    {
+        if (f != nullptr)
+            std::fclose(f);
+        if (out != nullptr)
+            std::fclose(out);
+        ESP_LOGW(TAG, "Failed to compact file %s", mFileName.c_str());
+        return false;
+    }
+
+    // Действующие записи копируются в порядке файла, новые смещения заменяют старые в индексе
+    // только после завершения транзакции - при ошибке индекс соответствует старому файлу.
+    std::vector<uint32_t> offsets(mIndex.size());
+    std::vector<size_t> order(mIndex.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b)
+              { return mIndex[a].second < mIndex[b].second; });
+    bool res = true;
+    uint32_t size = 0;
+    uint8_t head[KV_HEADER_SIZE];
+    std::string data;
+    for (size_t i : order)
+    {
+        std::fseek(f, mIndex[i].second, SEEK_SET);
+        res = (std::fread(head, 1, KV_HEADER_SIZE, f) == KV_HEADER_SIZE);
+        uint16_t vlen;
+        std::memcpy(&vlen, &head[2], 2);
+        data.resize(head[1] + vlen);
+        res = res && (std::fread(data.data(), 1, data.size(), f) == data.size());
+        res = res && (std::fwrite(head, 1, KV_HEADER_SIZE, out) == KV_HEADER_SIZE);
+        res = res && (std::fwrite(data.data(), 1, data.size(), out) == data.size());
+        if (!res)
+            break;
+        offsets[i] = size;
+        size += KV_HEADER_SIZE + data.size();
+    }
+    std::fclose(f);
+    res &= (std::fclose(out) == 0);
+    if (!res)
+    {
+        std::remove((str + '$').c_str());
+        ESP_LOGE(TAG, "Failed to compact file %s", mFileName.c_str());
+        return false;
+    }
+    if (!CSpiffsSystem::commitFile(mFileName))
+    {
+        // Старый файл мог быть уже удалён, состояние определится при следующей загрузке.
+        std::remove((str + '$').c_str());
+        ESP_LOGE(TAG, "Failed to compact file %s", mFileName.c_str());
+        mLoaded = false;
+        return false;
+    }
+    for (size_t i = 0; i < offsets.size(); i++)
+        mIndex[i].second = offsets[i];
+    ESP_LOGI(TAG, "%s was compacted %" PRIu32 " -> %" PRIu32, mFileName.c_str(), mSize, size);
+    mSize = size;
+    mGarbage = 0;
+    return true;
+}
@@ -0,0 +1,291 @@
+/*!
+    \file
+    \brief Класс журнала в SPIFFS с ротацией файлов.
+    \authors Близнец Р.А. (r.bliznets@gmail.com)
+    \version 0.1.0.0
+    \date 17.10.2026
+*/
+
+#include "CRotatingLog.h"
+#include "CSpiffsSystem.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_rom_crc.h"
+#include "esp_log.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cinttypes>
+#include <dirent.h>
+
+static const char *TAG = "log";
+
+CRotatingLog::CRotatingLog(const std::string &name, uint16_t files, uint32_t size, uint32_t buffer) : mName(name),
+                                                                                                      mFiles((files < 2) ? 2 : files),
+                                                                                                      mMaxSize(size),
+                                                                                                      mBufSize((buffer > size) ? size : buffer)
+{
+    mBuffer = new uint8_t[mBufSize];
+}
+
+CRotatingLog::~CRotatingLog()
+{
+    flush();
+    delete[] mBuffer;
+}
+
+uint32_t CRotatingLog::scan(const std::string &fname, uint32_t from, uint32_t to, std::string *res, uint32_t &last, bool &found)
+{
+    found = false;
+    FILE *f = std::fopen(CSpiffsSystem::path(fname).c_str(), "r");
+    if (f == nullptr)
+        return 0;
+    uint32_t count = 0;
+    std::string data; // Непрочитанная часть файла, начиная с pos.
+    size_t pos = 0;
+    bool eof = false;
+    // Дочитать файл, пока с pos не будет size байт, либо до конца файла.
+    auto fill = [&](size_t size)
+    {
+        while (!eof && ((data.size() - pos) < size))
+        {
+            data.erase(0, pos);
+            pos = 0;
+            size_t sz = data.size();
+            data.resize(sz + SPIFFS_COPY_CHUNK);
+            size_t rd = std::fread(&data[sz], 1, SPIFFS_COPY_CHUNK, f);
+            data.resize(sz + rd);
+            eof = (rd != SPIFFS_COPY_CHUNK);
+        }
+        return (data.size() - pos) >= size;
+    };
+    while (fill(LOG_HEADER_SIZE))
+    {
+        const uint8_t *p = (const uint8_t *)&data[pos];
+        uint16_t len;
+        uint32_t n;
+        uint32_t crc;
+        std::memcpy(&len, &p[1], 2);
+        std::memcpy(&n, &p[3], 4);
+        std::memcpy(&crc, &p[7], 4);
+        // Повреждённая запись пропускается поиском следующего LOG_MAGIC.
+        if ((p[0] != LOG_MAGIC) || !fill(LOG_HEADER_SIZE + len))
+        {
+            pos++;
+            continue;
+        }
+        p = (const uint8_t *)&data[pos];
+        if (esp_rom_crc32_le(esp_rom_crc32_le(0, &p[3], 4), &p[LOG_HEADER_SIZE], len) != crc)
+        {
+            pos++;
+            continue;
+        }
+        last = n;
+        found = true;
+        if ((n >= from) && (n <= to))
+        {
+            if (res != nullptr)
+                res->append((const char *)p, LOG_HEADER_SIZE + len);
+            count++;
+        }
+        pos += LOG_HEADER_SIZE + len;
+    }
+    std::fclose(f);
+    return count;
+}
+
+bool CRotatingLog::init()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    DIR *dp = opendir(CSpiffsSystem::base());
+    if (dp == nullptr)
+    {
+        ESP_LOGE(TAG, "Failed to open dir %s", CSpiffsSystem::base());
+        return false;
+    }
+    bool found = false;
+    std::string prefix = mName + ".";
+    struct dirent *entry;
+    while ((entry = readdir(dp)))
+    {
+        std::string fname = entry->d_name;
+        if ((fname.compare(0, prefix.size(), prefix) != 0) || (fname.size() == prefix.size()) ||
+            (fname.find_first_not_of("0123456789", prefix.size()) != std::string::npos))
+            continue;
+        uint32_t n = std::strtoul(&fname[prefix.size()], nullptr, 10);
+        if (!found || (n < mFirstFile))
+            mFirstFile = n;
+        if (!found || (n > mLastFile))
+            mLastFile = n;
+        found = true;
+    }
+    closedir(dp);
+
+    mFileSize = 0;
+    mNext = 0;
+    if (found)
+    {
+        // Номер следующей записи - после последней правильной записи в самом новом файле.
+        FILE *f = std::fopen(CSpiffsSystem::path(fileName(mLastFile)).c_str(), "r");
+        if (f != nullptr)
+        {
+            std::fseek(f, 0, SEEK_END);
+            mFileSize = std::ftell(f);
+            std::fclose(f);
+        }
+        for (uint32_t n = mLastFile + 1; n > mFirstFile; n--)
+        {
+            uint32_t last;
+            bool valid;
+            scan(fileName(n - 1), 1, 0, nullptr, last, valid);
+            if (valid)
+            {
+                mNext = last + 1;
+                break;
+            }
+        }
+    }
+    ESP_LOGI(TAG, "%s: files %" PRIu32 "..%" PRIu32 ", next record %" PRIu32, mName.c_str(), mFirstFile, mLastFile, mNext);
+    return true;
+}
+
+bool CRotatingLog::write(const uint8_t *data, uint16_t size)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if ((LOG_HEADER_SIZE + (uint32_t)size) > mBufSize)
+    {
+        mDropped++;
+        return false;
+    }
+    if ((mUsed + LOG_HEADER_SIZE + size) > mBufSize)
+        flushBuffer();
+    uint8_t *p = &mBuffer[mUsed];
+    p[0] = LOG_MAGIC;
+    std::memcpy(&p[1], &size, 2);
+    std::memcpy(&p[3], &mNext, 4);
+    uint32_t crc = esp_rom_crc32_le(esp_rom_crc32_le(0, &p[3], 4), data, size);
+    std::memcpy(&p[7], &crc, 4);
+    std::memcpy(&p[LOG_HEADER_SIZE], data, size);
+    mUsed += LOG_HEADER_SIZE + size;
+    mNext++;
+    mWritten++;
+    return true;
+}
+
+bool CRotatingLog::flushBuffer()
+{
+    if (mUsed == 0)
+        return true;
+    TickType_t t = xTaskGetTickCount();
+    if ((mFileSize != 0) && ((mFileSize + mUsed) > mMaxSize))
+    {
+        mLastFile++;
+        mFileSize = 0;
+        while ((mLastFile - mFirstFile) >= mFiles)
+        {
+            std::remove(CSpiffsSystem::path(fileName(mFirstFile)).c_str());
+            CSpiffsSystem::invalidate(fileName(mFirstFile));
+            mFirstFile++;
+        }
+    }
+    bool res = false;
+    CSpiffsSystem::invalidate(fileName(mLastFile));
+    FILE *f = std::fopen(CSpiffsSystem::path(fileName(mLastFile)).c_str(), "a");
+    if (f != nullptr)
+    {
+        res = (std::fwrite(mBuffer, 1, mUsed, f) == mUsed);
+        std::fclose(f);
+    }
+    if (res)
+        mFileSize += mUsed;
+    else
+        ESP_LOGW(TAG, "Failed to write to file %s", fileName(mLastFile).c_str());
+    mUsed = 0;
+    mFlushes++;
+    mFlushTime += (xTaskGetTickCount() - t) * portTICK_PERIOD_MS;
+    return res;
+}
+
+bool CRotatingLog::flush()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return flushBuffer();
+}
+
+uint32_t CRotatingLog::read(uint32_t from, uint32_t to, std::string &data)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    flushBuffer();
+    data.clear();
+    uint32_t count = 0;
+    uint32_t last;
+    bool valid;
+    for (uint32_t n = mFirstFile; n <= mLastFile; n++)
+        count += scan(fileName(n), from, to, &data, last, valid);
+    return count;
+}
+
+std::string CRotatingLog::command(CJsonParser *cmd, CBufferSystem *buf, int beg)
+{
+    std::string answer = "";
+    int t2;
+    int t3;
+    std::string name;
+    if (cmd->getObject(beg, "log", t2) && (!cmd->getString(t2, "name", name) || (name == mName)))
+    {
+        answer = "\"log\":{\"name\":\"" + mName + "\",";
+        if (cmd->getField(t2, "info"))
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            uint32_t first = mNext;
+            // Номер первой записи - из заголовка в начале файла, файл целиком не читается.
+            for (uint32_t n = mFirstFile; (n <= mLastFile) && (first == mNext); n++)
+            {
+                uint8_t header[LOG_HEADER_SIZE];
+                FILE *f = std::fopen(CSpiffsSystem::path(fileName(n)).c_str(), "r");
+                if (f == nullptr)
+                    continue;
+                if ((std::fread(header, 1, LOG_HEADER_SIZE, f) == LOG_HEADER_SIZE) && (header[0] == LOG_MAGIC))
+                    std::memcpy(&first, &header[3], 4);
+                std::fclose(f);
+            }
+            answer += "\"files\":[" + std::to_string(mFirstFile) + "," + std::to_string(mLastFile) + "]";
+            answer += ",\"records\":[" + std::to_string(first) + "," + std::to_string(mNext) + "]";
+            answer += ",\"written\":" + std::to_string(mWritten) + ",\"dropped\":" + std::to_string(mDropped);
+            answer += ",\"flushes\":" + std::to_string(mFlushes) + ",\"flush_ms\":" + std::to_string(mFlushTime);
+        }
+        else if (cmd->getArray(t2, "rd", t3))
+        {
+            uint32_t range[2] = {0, 0xffffffff};
+            int k = 0;
+            for (int i : cmd->elements(t3))
+            {
+                int x;
+                if ((k < 2) && cmd->getInt(i, x))
+                    range[k] = x;
+                k++;
+            }
+            int part = BUF_PART_SIZE;
+            cmd->getInt(t2, "part", part);
+            std::string data;
+            uint32_t count = read(range[0], range[1], data);
+            if (count == 0)
+                answer += "\"error\":\"No records\"";
+            else if ((buf == nullptr) || !buf->load((const uint8_t *)data.data(), data.size(), part))
+                answer += "\"error\":\"Buf wasn't created " + std::to_string(data.size()) + "\"";
+            else
+            {
+                answer += "\"records\":" + std::to_string(count) + ",\"size\":" + std::to_string(data.size());
+                answer += ",\"part\":" + std::to_string(part);
+            }
+        }
+        else if (cmd->getField(t2, "flush"))
+        {
+            answer += flush() ? "\"ok\":\"log was flushed\"" : "\"error\":\"Failed to flush log\"";
+        }
+        else
+            answer.pop_back();
+        answer += '}';
+    }
+    return answer;
+}
@@ -7,74 +7,57 @@
 */
 
 #include "CSpiffsSystem.h"
-#include "esp_spiffs.h"
 #include "esp_log.h"
+#include "mbedtls/sha256.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include <cstdio>
 #include <dirent.h>
+#include <algorithm>
 #include <stdexcept>
 
 static const char *TAG = "spiffs";
 
+CFsBackend *CSpiffsSystem::mFs = nullptr;
+std::vector<CSpiffsSystem::SDigest> CSpiffsSystem::mDigests;
+std::mutex CSpiffsSystem::mDigestMutex;
+
 void CSpiffsSystem::init(bool check)
 {
-    esp_vfs_spiffs_conf_t conf = {
-        .base_path = "/spiffs",
-        .partition_label = nullptr,
-        .max_files = 15,
-        .format_if_mount_failed = true};
-    esp_err_t ret = esp_vfs_spiffs_register(&conf);
-    if (ret != ESP_OK)
-    {
-        if (ret == ESP_FAIL)
-        {
-            ESP_LOGE(TAG, "Failed to mount or format filesystem");
-        }
-        else if (ret == ESP_ERR_NOT_FOUND)
-        {
-            ESP_LOGE(TAG, "Failed to find SPIFFS partition");
-        }
-        else
-        {
-            ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
-        }
+    free();
+    mFs = CFsBackend::create();
+    if (!mFs->mount())
         return;
-    }
 
     check |= endTransaction();
-    if (check)
-    {
-        ESP_LOGI(TAG, "SPIFFS checking...");
-        ret = esp_spiffs_check(conf.partition_label);
-        if (ret != ESP_OK)
-        {
-            ESP_LOGE(TAG, "SPIFFS_check() failed (%s)", esp_err_to_name(ret));
-            return;
-        }
-        else
-        {
-            ESP_LOGI(TAG, "SPIFFS_check() successful");
-        }
-    }
+    if (check && !mFs->check())
+        return;
 
-    esp_spiffs_gc(conf.partition_label, 0x100000);
+    mFs->gc();
+    kv().load();
 
     size_t total = 0, used = 0;
-    ret = esp_spiffs_info(conf.partition_label, &total, &used);
-    if (ret != ESP_OK)
+    if (!mFs->info(total, used))
     {
-        ESP_LOGE(TAG, "Failed to get SPIFFS partition information (%s). Formatting...", esp_err_to_name(ret));
-        esp_spiffs_format(conf.partition_label);
+        ESP_LOGE(TAG, "Failed to get %s partition information. Formatting...", mFs->name());
+        mFs->format();
         return;
     }
     else
     {
-        ESP_LOGI(TAG, "Partition size: total: %d, used: %d", total, used);
+        ESP_LOGI(TAG, "Partition %s size: total: %zu, used: %zu", mFs->name(), total, used);
     }
 }
 
 void CSpiffsSystem::free()
 {
-    esp_vfs_spiffs_unregister(nullptr);
+    if (mFs != nullptr)
+    {
+        mFs->unmount();
+        delete mFs;
+        mFs = nullptr;
+    }
 }
 
 bool CSpiffsSystem::endTransaction()
@@ -82,15 +65,15 @@ bool CSpiffsSystem::endTransaction()
     struct dirent *entry;
     DIR *dp;
     bool res = false;
-    dp = opendir("/spiffs");
+    dp = opendir(base());
     if (dp == nullptr)
     {
-        ESP_LOGE(TAG, "Failed to open dir /spiffs");
+        ESP_LOGE(TAG, "Failed to open dir %s", base());
         res = true;
     }
     else
     {
-        std::string str = "/spiffs/";
+        std::string str = path();
         while ((entry = readdir(dp)))
         {
             std::string fname = entry->d_name;
@@ -113,11 +96,285 @@ bool CSpiffsSystem::endTransaction()
     return res;
 }
 
-std::string CSpiffsSystem::command(CJsonParser *cmd)
+bool CSpiffsSystem::readFile(const std::string &fname, std::string &data)
+{
+    std::string str = path(fname);
+    FILE *f = std::fopen(str.c_str(), "r");
+    if (f == nullptr)
+        return false;
+    std::fseek(f, 0, SEEK_END);
+    long size = std::ftell(f);
+    std::fseek(f, 0, SEEK_SET);
+    bool res = (size >= 0);
+    if (res)
+    {
+        data.resize(size);
+        res = (std::fread(data.data(), 1, size, f) == (size_t)size);
+    }
+    std::fclose(f);
+    return res;
+}
+
+bool CSpiffsSystem::writeFile(const std::string &fname, const std::string &data)
+{
+    std::string str = path(fname);
+    FILE *f = std::fopen((str + '$').c_str(), "w");
+    if (f == nullptr)
+        return false;
+    bool res = (std::fwrite(data.data(), 1, data.size(), f) == data.size());
+    res &= (std::fclose(f) == 0);
+    if (!res)
+    {
+        std::remove((str + '$').c_str());
+        return false;
+    }
+    return commitFile(fname);
+}
+
+bool CSpiffsSystem::commitFile(const std::string &fname)
+{
+    invalidate(fname);
+    std::string str = path(fname);
+    if (std::rename((str + '$').c_str(), (str + '!').c_str()) != 0)
+        return false;
+    std::remove(str.c_str());
+    return (std::rename((str + '!').c_str(), str.c_str()) == 0);
+}
+
+uint32_t CSpiffsSystem::blockSum(const uint8_t *data, uint32_t size, uint8_t strong[8])
+{
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        a += data[i];
+        b += (size - i) * data[i];
+    }
+    uint8_t hash[32];
+    mbedtls_sha256(data, size, hash, 0);
+    std::memcpy(strong, hash, 8);
+    return (a & 0xffff) | (b << 16);
+}
+
+CKeyValue &CSpiffsSystem::kv()
+{
+    static CKeyValue store("kv");
+    return store;
+}
+
+std::string CSpiffsSystem::copyFile(const std::vector<std::string> &src, const std::string &fname, uint32_t &size, uint32_t skip, uint32_t skipSize)
+{
+    std::string str = path(fname);
+    FILE *out = std::fopen((str + '$').c_str(), "w");
+    if (out == nullptr)
+        return "Failed to open file " + fname;
+    std::string error;
+    uint8_t *data = new uint8_t[SPIFFS_COPY_CHUNK];
+    uint32_t pos = 0;
+    size = 0;
+    for (auto &name : src)
+    {
+        FILE *f = std::fopen(path(name).c_str(), "r");
+        if (f == nullptr)
+        {
+            error = "Failed to open file " + name;
+            break;
+        }
+        size_t n;
+        while (error.empty() && ((n = std::fread(data, 1, SPIFFS_COPY_CHUNK, f)) != 0))
+        {
+            // Из блока [pos, pos+n) записываются части вне [skip, skip+skipSize).
+            uint32_t a = (skip > pos) ? std::min<uint32_t>(skip - pos, n) : 0;
+            uint32_t b = ((skip + skipSize) > pos) ? std::min<uint32_t>(skip + skipSize - pos, n) : 0;
+            if ((a != 0) && (std::fwrite(data, 1, a, out) != a))
+                error = "Failed to write to file " + fname;
+            else if ((b < n) && (std::fwrite(&data[b], 1, n - b, out) != (n - b)))
+                error = "Failed to write to file " + fname;
+            size += a + ((b < n) ? (n - b) : 0);
+            pos += n;
+        }
+        std::fclose(f);
+        if (!error.empty())
+            break;
+    }
+    delete[] data;
+    if ((std::fclose(out) != 0) && error.empty())
+        error = "Failed to write to file " + fname;
+    if (error.empty() && !commitFile(fname))
+        error = "Failed to commit file " + fname;
+    if (!error.empty())
+        std::remove((str + '$').c_str());
+    return error;
+}
+
+void CSpiffsSystem::invalidate(const std::string &fname)
+{
+    std::lock_guard<std::mutex> lock(mDigestMutex);
+    mDigests.erase(std::remove_if(mDigests.begin(), mDigests.end(), [&fname](const SDigest &d)
+                                  { return d.name == fname; }),
+                   mDigests.end());
+}
+
+bool CSpiffsSystem::digest(const std::string &fname, uint32_t offset, uint32_t &size, uint8_t alg, uint32_t &crc, uint8_t sha[32], bool &cached)
+{
+    FILE *f = std::fopen(path(fname).c_str(), "r");
+    if (f == nullptr)
+        return false;
+    std::fseek(f, 0, SEEK_END);
+    uint32_t fsize = std::ftell(f);
+    if (offset > fsize)
+    {
+        std::fclose(f);
+        return false;
+    }
+    if ((size == 0) || (size > (fsize - offset)))
+        size = fsize - offset;
+
+    // Размер файла проверяется на случай записи в обход invalidate().
+    cached = false;
+    {
+        std::lock_guard<std::mutex> lock(mDigestMutex);
+        for (auto &d : mDigests)
+        {
+            if ((d.name == fname) && (d.offset == offset) && (d.size == size) && (d.fileSize == fsize) && ((d.alg & alg) == alg))
+            {
+                crc = d.crc;
+                std::memcpy(sha, d.sha, 32);
+                cached = true;
+                break;
+            }
+        }
+    }
+    if (cached)
+    {
+        std::fclose(f);
+        return true;
+    }
+
+    SDigest d = {fname, offset, size, fsize, alg, 0, {}};
+    mbedtls_sha256_context ctx;
+    if ((alg & SPIFFS_SUM_SHA256) != 0)
+    {
+        mbedtls_sha256_init(&ctx);
+        mbedtls_sha256_starts(&ctx, 0);
+    }
+    uint8_t *data = new uint8_t[SPIFFS_COPY_CHUNK];
+    std::fseek(f, offset, SEEK_SET);
+    bool res = true;
+    uint32_t pos = offset;
+    uint32_t end = offset + size;
+    while (res && (pos < end))
+    {
+        // Первый блок дополняет смещение до границы SPIFFS_COPY_CHUNK.
+        uint32_t n = std::min<uint32_t>(SPIFFS_COPY_CHUNK - (pos % SPIFFS_COPY_CHUNK), end - pos);
+        res = (std::fread(data, 1, n, f) == n);
+        if (res && ((alg & SPIFFS_SUM_CRC32) != 0))
+            d.crc = esp_rom_crc32_le(d.crc, data, n);
+        if (res && ((alg & SPIFFS_SUM_SHA256) != 0))
+            mbedtls_sha256_update(&ctx, data, n);
+        pos += n;
+    }
+    delete[] data;
+    std::fclose(f);
+    if ((alg & SPIFFS_SUM_SHA256) != 0)
+    {
+        mbedtls_sha256_finish(&ctx, d.sha);
+        mbedtls_sha256_free(&ctx);
+    }
+    if (!res)
+        return false;
+
+    crc = d.crc;
+    std::memcpy(sha, d.sha, 32);
+    std::lock_guard<std::mutex> lock(mDigestMutex);
+    mDigests.erase(std::remove_if(mDigests.begin(), mDigests.end(), [&d](const SDigest &x)
+                                  { return (x.name == d.name) && (x.offset == d.offset) && (x.size == d.size); }),
+                   mDigests.end());
+    if (mDigests.size() >= SPIFFS_SUM_CACHE)
+        mDigests.erase(mDigests.begin());
+    mDigests.push_back(d);
+    return true;
+}
+
+std::string CSpiffsSystem::bench(int files, int size)
+{
+    const int chunk = 256;
+    uint8_t *data = new uint8_t[chunk];
+    for (int i = 0; i < chunk; i++)
+        data[i] = i;
+    bool res = true;
+    uint32_t time[5];
+    TickType_t t = xTaskGetTickCount();
+    for (int i = 0; (i < files) && res; i++)
+    {
+        FILE *f = std::fopen(path("bench." + std::to_string(i)).c_str(), "w");
+        res = (f != nullptr);
+        for (int k = 0; (k < size) && res; k += chunk)
+            res = (std::fwrite(data, 1, chunk, f) == chunk);
+        if (f != nullptr)
+            res &= (std::fclose(f) == 0);
+    }
+    time[0] = xTaskGetTickCount();
+    for (int i = 0; (i < files) && res; i++)
+    {
+        FILE *f = std::fopen(path("bench." + std::to_string(i)).c_str(), "r");
+        res = (f != nullptr);
+        for (int k = 0; (k < size) && res; k += chunk)
+            res = (std::fread(data, 1, chunk, f) == chunk);
+        if (f != nullptr)
+            std::fclose(f);
+    }
+    time[1] = xTaskGetTickCount();
+    // Запись блоков в случайные места файла (как при приёме пакетов не по порядку).
+    uint32_t seed = 1;
+    for (int i = 0; (i < files) && res; i++)
+    {
+        FILE *f = std::fopen(path("bench." + std::to_string(i)).c_str(), "r+");
+        res = (f != nullptr);
+        for (int k = 0; (k < 16) && res; k++)
+        {
+            seed = seed * 1103515245 + 12345;
+            std::fseek(f, ((seed >> 8) % (size / chunk)) * chunk, SEEK_SET);
+            res = (std::fwrite(data, 1, chunk, f) == chunk);
+        }
+        if (f != nullptr)
+            res &= (std::fclose(f) == 0);
+    }
+    time[2] = xTaskGetTickCount();
+    DIR *dp = opendir(base());
+    if (dp != nullptr)
+    {
+        while (readdir(dp))
+            ;
+        closedir(dp);
+    }
+    time[3] = xTaskGetTickCount();
+    for (int i = 0; i < files; i++)
+    {
+        std::remove(path("bench." + std::to_string(i)).c_str());
+        invalidate("bench." + std::to_string(i));
+    }
+    time[4] = xTaskGetTickCount();
+    delete[] data;
+
+    if (!res)
+        return "\"error\":\"Failed to access bench files\"";
+    std::string answer = "\"files\":" + std::to_string(files) + ",\"size\":" + std::to_string(size);
+    const char *names[5] = {"write", "read", "rewrite", "ls", "rm"};
+    for (int i = 0; i < 5; i++)
+    {
+        answer += ",\"" + std::string(names[i]) + "\":" + std::to_string((time[i] - t) * portTICK_PERIOD_MS);
+        t = time[i];
+    }
+    return answer;
+}
+
+std::string CSpiffsSystem::command(CJsonParser *cmd, int beg)
 {
     std::string answer = "";
     int t2;
-    if (cmd->getObject(1, "spiffs", t2))
+    int t3;
+    if (cmd->getObject(beg, "spiffs", t2))
     {
         std::string fname;
         std::string fname2;
@@ -126,15 +383,15 @@ std::string CSpiffsSystem::command(CJsonParser *cmd)
             answer = "\"spiffs\":{";
             struct dirent *entry;
             DIR *dp;
-            dp = opendir("/spiffs");
+            dp = opendir(base());
             if (dp == nullptr)
             {
-                ESP_LOGE(TAG, "Failed to open dir /spiffs");
-                answer += "\"error\":\"Failed to open dir /spiffs\"";
+                ESP_LOGE(TAG, "Failed to open dir %s", base());
+                answer += std::string("\"error\":\"Failed to open dir ") + base() + "\"";
             }
             else
             {
-                std::string str = "/spiffs/";
+                std::string str = path();
                 answer += "\"files\":[";
                 bool point = false;
                 while ((entry = readdir(dp)))
@@ -161,7 +418,7 @@ std::string CSpiffsSystem::command(CJsonParser *cmd)
         else if (cmd->getString(t2, "rd", fname))
         {
             answer = "\"spiffs\":{";
-            std::string str = "/spiffs/" + fname;
+            std::string str = path(fname);
             FILE *f = std::fopen(str.c_str(), "r");
             if (f == nullptr)
             {
@@ -172,16 +429,15 @@ std::string CSpiffsSystem::command(CJsonParser *cmd)
             {
                 answer += "\"fr\":\"" + fname + "\",";
                 int offset = 0;
-                cmd->getInt(t2, "offset", offset);
-                answer += "\"offset\":" + std::to_string(offset) + ",\"data\":\"";
                 int size = 96;
-                cmd->getInt(t2, "size", size);
+                cmd->getMany(t2, {{"offset", &offset}, {"size", &size}});
+                answer += "\"offset\":" + std::to_string(offset) + ",\"data\":\"";
                 uint8_t *data = new uint8_t[size];
                 std::fseek(f, offset, SEEK_SET);
                 size = std::fread(data, 1, size, f);
                 std::fclose(f);
                 char tmp[3];
-                for (size_t i = 0; i < size; i++)
+                for (int i = 0; i < size; i++)
                 {
                     std::sprintf(tmp, "%02x", data[i]);
                     answer += tmp;
@@ -194,15 +450,38 @@ std::string CSpiffsSystem::command(CJsonParser *cmd)
         else if (cmd->getString(t2, "rm", fname))
         {
             answer = "\"spiffs\":{";
-            std::string str = "/spiffs/" + fname;
+            std::string str = path(fname);
             std::remove(str.c_str());
+            invalidate(fname);
             answer += "\"fd\":\"" + fname + "\"}";
         }
+        else if (cmd->getArray(t2, "rm", t3))
+        {
+            answer = "\"spiffs\":{\"fd\":[";
+            bool point = false;
+            for (int i : cmd->elements(t3))
+            {
+                if (cmd->getString(i, fname))
+                {
+                    std::string str = path(fname);
+                    std::remove(str.c_str());
+                    invalidate(fname);
+                    if (point)
+                        answer += ',';
+                    else
+                        point = true;
+                    answer += "\"" + fname + "\"";
+                }
+            }
+            answer += "]}";
+        }
         else if ((cmd->getString(t2, "old", fname)) && (cmd->getString(t2, "new", fname2)))
         {
             answer = "\"spiffs\":{";
-            std::string str = "/spiffs/" + fname;
-            std::string str2 = "/spiffs/" + fname2;
+            std::string str = path(fname);
+            std::string str2 = path(fname2);
+            invalidate(fname);
+            invalidate(fname2);
             if (std::rename(str.c_str(), str2.c_str()) != 0)
             {
                 ESP_LOGW(TAG, "Failed to rename file %s to %s", fname.c_str(), fname2.c_str());
@@ -214,10 +493,271 @@ std::string CSpiffsSystem::command(CJsonParser *cmd)
             }
             answer += '}';
         }
+        else if (cmd->getString(t2, "sums", fname))
+        {
+            answer = "\"spiffs\":{";
+            std::string str = path(fname);
+            FILE *f = std::fopen(str.c_str(), "r");
+            int block = 1024;
+            int from = 0;
+            int count = 32;
+            cmd->getMany(t2, {{"block", &block}, {"from", &from}, {"count", &count}});
+            if (f == nullptr)
+            {
+                ESP_LOGW(TAG, "Failed to open file %s", fname.c_str());
+                answer += "\"error\":\"Failed to open file " + fname + "\"";
+            }
+            else if ((block < SPIFFS_BLOCK_MIN) || (block > SPIFFS_BLOCK_MAX) || (from < 0) || (count <= 0))
+            {
+                answer += "\"error\":\"Wrong block of file " + fname + "\"";
+                std::fclose(f);
+            }
+            else
+            {
+                std::fseek(f, 0, SEEK_END);
+                int32_t sz = std::ftell(f);
+                std::fseek(f, std::min<uint64_t>((uint64_t)from * block, sz), SEEK_SET);
+                answer += "\"fs\":\"" + fname + "\",\"size\":" + std::to_string(sz) + ",\"block\":" + std::to_string(block);
+                answer += ",\"from\":" + std::to_string(from) + ",\"sums\":[";
+                uint8_t *data = new uint8_t[block];
+                uint8_t strong[8];
+                char tmp[32];
+                for (int i = 0; i < count; i++)
+                {
+                    size_t size = std::fread(data, 1, block, f);
+                    if (size == 0)
+                        break;
+                    uint32_t weak = blockSum(data, size, strong);
+                    std::sprintf(tmp, "%s[%lu,\"", (i == 0) ? "" : ",", (unsigned long)weak);
+                    answer += tmp;
+                    for (int j = 0; j < 8; j++)
+                    {
+                        std::sprintf(tmp, "%02x", strong[j]);
+                        answer += tmp;
+                    }
+                    answer += "\"]";
+                }
+                delete[] data;
+                std::fclose(f);
+                answer += ']';
+            }
+            answer += '}';
+        }
+        else if (cmd->getString(t2, "patch", fname) && cmd->getArray(t2, "ops", t3))
+        {
+            answer = "\"spiffs\":{";
+            std::string json;
+            std::string error;
+            int count = 0;
+            if (cmd->isCbor())
+                error = "Patch of file " + fname + " requires json command";
+            else if (!readFile(fname, json))
+                error = "Failed to open file " + fname;
+            else
+            {
+                // Операции применяются последовательно, каждая к результату предыдущей.
+                for (int i : cmd->elements(t3))
+                {
+                    std::string op;
+                    std::string path;
+                    std::string value;
+                    int t4;
+                    if (!cmd->getObject(i, t4) || ((cmd->getMany(t4, {{"op", &op}, {"path", &path}}) & 0x03) != 0x03) ||
+                        (!cmd->getText(t4, "value", value) && (op != "remove")))
+                    {
+                        error = "Wrong op " + std::to_string(count) + " of patch";
+                        break;
+                    }
+                    CJsonParser doc;
+                    if (doc.parse(json.c_str()) != 1)
+                    {
+                        error = "Failed to parse file " + fname;
+                        break;
+                    }
+                    error = doc.patch(op, path, value, json);
+                    if (!error.empty())
+                        break;
+                    count++;
+                }
+                if (error.empty() && !writeFile(fname, json))
+                    error = "Failed to write to file " + fname;
+            }
+            if (error.empty())
+            {
+                answer += "\"fp\":\"" + fname + "\",\"ops\":" + std::to_string(count);
+            }
+            else
+            {
+                ESP_LOGW(TAG, "%s", error.c_str());
+                answer += "\"error\":\"" + error + "\"";
+            }
+            answer += '}';
+        }
+        else if ((cmd->getString(t2, "cp", fname) || cmd->getArray(t2, "cat", t3)) && cmd->getString(t2, "to", fname2))
+        {
+            answer = "\"spiffs\":{";
+            std::vector<std::string> names;
+            bool append = false;
+            cmd->getBool(t2, "append", append);
+            if (append)
+                names.push_back(fname2);
+            if (cmd->getArray(t2, "cat", t3))
+            {
+                for (int i : cmd->elements(t3))
+                {
+                    if (cmd->getString(i, fname))
+                        names.push_back(fname);
+                }
+            }
+            else
+                names.push_back(fname);
+            int skip[2] = {0, 0};
+            int k = 0;
+            if (cmd->getArray(t2, "skip", t3))
+            {
+                for (int i : cmd->elements(t3))
+                {
+                    if ((k < 2) && cmd->getInt(i, skip[k]))
+                        k++;
+                }
+            }
+            uint32_t size;
+            std::string error;
+            if ((skip[0] < 0) || (skip[1] < 0))
+                error = "Wrong skip of file " + fname2;
+            else
+                error = copyFile(names, fname2, size, skip[0], skip[1]);
+            if (error.empty())
+            {
+                answer += "\"fc\":\"" + fname2 + "\",\"size\":" + std::to_string(size);
+            }
+            else
+            {
+                ESP_LOGW(TAG, "%s", error.c_str());
+                answer += "\"error\":\"" + error + "\"";
+            }
+            answer += '}';
+        }
+        else if (cmd->getString(t2, "sum", fname))
+        {
+            answer = "\"spiffs\":{";
+            std::string str = "";
+            int offset = 0;
+            int size = 0;
+            cmd->getMany(t2, {{"alg", &str}, {"offset", &offset}, {"size", &size}});
+            uint8_t alg = (str == "crc32") ? SPIFFS_SUM_CRC32 : ((str == "sha256") ? SPIFFS_SUM_SHA256 : (SPIFFS_SUM_CRC32 | SPIFFS_SUM_SHA256));
+            uint32_t sz = (size < 0) ? 0 : size;
+            uint32_t crc;
+            uint8_t sha[32];
+            bool cached;
+            TickType_t t = xTaskGetTickCount();
+            if ((offset < 0) || !digest(fname, offset, sz, alg, crc, sha, cached))
+            {
+                ESP_LOGW(TAG, "Failed to read file %s", fname.c_str());
+                answer += "\"error\":\"Failed to read file " + fname + "\"";
+            }
+            else
+            {
+                char tmp[9];
+                answer += "\"fh\":\"" + fname + "\",\"offset\":" + std::to_string(offset) + ",\"size\":" + std::to_string(sz);
+                if ((alg & SPIFFS_SUM_CRC32) != 0)
+                {
+                    std::sprintf(tmp, "%08lx", (unsigned long)crc);
+                    answer += ",\"crc32\":\"" + std::string(tmp) + "\"";
+                }
+                if ((alg & SPIFFS_SUM_SHA256) != 0)
+                {
+                    answer += ",\"sha256\":\"";
+                    for (int i = 0; i < 32; i++)
+                    {
+                        std::sprintf(tmp, "%02x", sha[i]);
+                        answer += tmp;
+                    }
+                    answer += "\"";
+                }
+                if (cached)
+                    answer += ",\"cached\":true";
+                else
+                    answer += ",\"ms\":" + std::to_string((xTaskGetTickCount() - t) * portTICK_PERIOD_MS);
+            }
+            answer += '}';
+        }
+        else if (cmd->getField(t2, "info"))
+        {
+            answer = "\"spiffs\":{";
+            size_t total = 0, used = 0;
+            if ((mFs == nullptr) || !mFs->info(total, used))
+                answer += "\"error\":\"Failed to get partition information\"";
+            else
+            {
+                answer += "\"fs\":\"" + std::string(mFs->name()) + "\",\"total\":" + std::to_string(total);
+                answer += ",\"used\":" + std::to_string(used);
+            }
+            answer += '}';
+        }
+        else if (cmd->getField(t2, "bench") || cmd->getObject(t2, "bench", t3))
+        {
+            int files = 8;
+            int size = 4096;
+            if (!cmd->getField(t2, "bench"))
+                cmd->getMany(t3, {{"files", &files}, {"size", &size}});
+            answer = "\"spiffs\":{";
+            if ((files < 1) || (files > 64) || (size < 256) || (size > 0x100000))
+                answer += "\"error\":\"Wrong bench parameters\"";
+            else
+            {
+                size -= size % 256;
+                answer += "\"fs\":\"" + std::string((mFs != nullptr) ? mFs->name() : "") + "\"," + bench(files, size);
+            }
+            answer += '}';
+        }
+        else if (cmd->getString(t2, "get", fname))
+        {
+            answer = "\"spiffs\":{";
+            std::string value;
+            if (kv().get(fname, value))
+                answer += "\"kv\":\"" + fname + "\",\"value\":" + value;
+            else
+                answer += "\"error\":\"Key " + fname + " not found\"";
+            answer += '}';
+        }
+        else if (cmd->getString(t2, "put", fname))
+        {
+            answer = "\"spiffs\":{";
+            std::string value;
+            if (cmd->isCbor())
+                answer += "\"error\":\"Put of key " + fname + " requires json command\"";
+            else if (!cmd->getText(t2, "value", value))
+                answer += "\"error\":\"No value of key " + fname + "\"";
+            else if (!kv().put(fname, value))
+                answer += "\"error\":\"Failed to put key " + fname + "\"";
+            else
+                answer += "\"kv\":\"" + fname + "\",\"keys\":" + std::to_string(kv().size());
+            answer += '}';
+        }
+        else if (cmd->getString(t2, "del", fname))
+        {
+            answer = "\"spiffs\":{";
+            if (kv().del(fname))
+                answer += "\"kd\":\"" + fname + "\",\"keys\":" + std::to_string(kv().size());
+            else
+                answer += "\"error\":\"Key " + fname + " not found\"";
+            answer += '}';
+        }
+        else if (cmd->getField(t2, "compact"))
+        {
+            answer = "\"spiffs\":{";
+            if (kv().compact())
+                answer += "\"keys\":" + std::to_string(kv().size()) + ",\"size\":" + std::to_string(kv().fileSize());
+            else
+                answer += "\"error\":\"Failed to compact kv\"";
+            answer += '}';
+        }
         else if (cmd->getString(t2, "wr", fname))
         {
             answer = "\"spiffs\":{";
-            std::string str = "/spiffs/" + fname;
+            std::string str = path(fname);
+            invalidate(fname);
             FILE *f = std::fopen(str.c_str(), "a");
             if (f == nullptr)
             {
@@ -227,26 +767,34 @@ std::string CSpiffsSystem::command(CJsonParser *cmd)
             else
             {
                 int offset = 0;
-                cmd->getInt(t2, "offset", offset);
+                uint32_t mask = cmd->getMany(t2, {{"offset", &offset}, {"data", &str}});
                 if (offset != std::ftell(f))
                 {
                     ESP_LOGW(TAG, "Wrong offset of file %s(%d)", fname.c_str(), offset);
                     answer += "\"error\":\"Wrong offset of file " + fname + "\"";
                 }
-                else if (cmd->getString(t2, "data", str))
+                else if ((mask & 0x02) != 0)
                 {
-                    int size = str.size() / 2;
+                    // В CBOR данные передаются байтовой строкой, в json - hex строкой.
+                    size_t size = cmd->isCbor() ? str.size() : str.size() / 2;
                     uint8_t *data = new uint8_t[size];
                     try
                     {
-                        for (size_t i = 0; i < size; i++)
+                        if (cmd->isCbor())
+                        {
+                            std::memcpy(data, str.data(), size);
+                        }
+                        else
                         {
-                            fname2 = str.substr(i * 2, 2);
-                            data[i] = std::stoi(fname2, 0, 16);
+                            for (size_t i = 0; i < size; i++)
+                            {
+                                fname2 = str.substr(i * 2, 2);
+                                data[i] = std::stoi(fname2, 0, 16);
+                            }
                         }
                         if (std::fwrite(data, 1, size, f) != size)
                         {
-                            ESP_LOGW(TAG, "Failed to write to file %s(%d)", fname.c_str(), size);
+                            ESP_LOGW(TAG, "Failed to write to file %s(%zu)", fname.c_str(), size);
                             answer += "\"error\":\"Failed to write to file " + fname + "\"";
                         }
                         else
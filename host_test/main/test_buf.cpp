@@ -0,0 +1,502 @@
+/*!
+    \file
+    \brief Тесты CBufferSystem: передача файла через канал с потерями, повторы против пакетов четности.
+    \authors Близнец Р.А. (r.bliznets@gmail.com)
+    \version 0.1.0.0
+    \date 17.10.2026
+*/
+
+#include "CBufferSystem.h"
+#include "CBufferPool.h"
+#include "CSpiffsSystem.h"
+#include "esp_rom_crc.h"
+#include "unity.h"
+#include "tests.h"
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Параметры канала.
+struct SChannel
+{
+    uint32_t seed;    ///< Начальное значение генератора (повторяемый результат).
+    int loss;         ///< Потери пакетов, %.
+    int dup;          ///< Повторы пакетов, %.
+    int reorder;      ///< Окно перестановки пакетов.
+    int mtu;          ///< Размер пакета 2-го канала (номер пакета + данные).
+    double bandwidth; ///< Пропускная способность, байт/мс.
+    double rtt;       ///< Время запрос-ответ (команды check и get), мс.
+};
+
+/// Канал с потерями, повторами и перестановкой пакетов.
+class CLossyChannel
+{
+protected:
+    const SChannel &mCfg;
+    uint32_t mSeed;
+    std::vector<std::vector<uint8_t>> mQueue; ///< Пакеты в канале, первый доставляется первым.
+    size_t mPos = 0;                          ///< Следующий доставляемый пакет.
+
+    uint32_t rnd(uint32_t n)
+    {
+        mSeed = mSeed * 1103515245 + 12345;
+        return (mSeed >> 8) % n;
+    }
+    void push(const std::vector<uint8_t> &pkt)
+    {
+        size_t wait = mQueue.size() - mPos;
+        size_t shift = (mCfg.reorder > 0) ? rnd(std::min<size_t>(mCfg.reorder, wait) + 1) : 0;
+        mQueue.insert(mQueue.end() - shift, pkt);
+    }
+
+public:
+    CLossyChannel(const SChannel &cfg) : mCfg(cfg), mSeed(cfg.seed) {};
+
+    void send(const std::vector<uint8_t> &pkt)
+    {
+        if ((int)rnd(100) < mCfg.loss)
+            return;
+        push(pkt);
+        if ((int)rnd(100) < mCfg.dup)
+            push(pkt);
+    }
+    bool receive(std::vector<uint8_t> &pkt)
+    {
+        if (mPos >= mQueue.size())
+        {
+            mQueue.clear();
+            mPos = 0;
+            return false;
+        }
+        pkt.swap(mQueue[mPos++]);
+        return true;
+    }
+};
+
+/// Доступ к буферу приёмника.
+class CTestBuffer : public CBufferSystem
+{
+public:
+    const uint8_t *data() { return mBuffer; };
+};
+
+/// Результат передачи.
+struct STransfer
+{
+    int rounds = 0;     ///< Циклов передача - check - get.
+    uint32_t sent = 0;  ///< Передано пакетов, включая четность и повторы.
+    uint32_t bytes = 0; ///< Передано байт 2-го канала.
+    double ms = 0;      ///< Расчетное время передачи.
+    int mem = 0;        ///< Память буфера приёмника.
+    bool ok = false;    ///< Данные приняты без ошибок.
+};
+
+/// Выполнить команду и разобрать ответ.
+static void run(CBufferSystem &buf, const std::string &cmd, CJsonParser &answer)
+{
+    CJsonParser p;
+    bool cancel = false;
+    TEST_ASSERT_EQUAL(1, p.parse(cmd.c_str()));
+    std::string res = "{" + buf.command(&p, cancel) + "}";
+    answer.parse(res.c_str());
+}
+
+/// Передать файл sim.bin: пакеты без подтверждений, затем check на приёмнике и get пропущенных пакетов.
+static STransfer transfer(const std::string &data, int fec, const SChannel &ch)
+{
+    STransfer res;
+    CBufferSystem tx;
+    CTestBuffer rx;
+    CJsonParser ans;
+    int part = ch.mtu - 2;
+    int t;
+    run(tx, "{\"buf\":{\"rd\":\"sim.bin\",\"part\":" + std::to_string(part) + ",\"fec\":" + std::to_string(fec) + "}}", ans);
+    run(rx, "{\"buf\":{\"create\":" + std::to_string(data.size()) + ",\"part\":" + std::to_string(part) + ",\"fec\":" + std::to_string(fec) + "}}", ans);
+    CLossyChannel link(ch);
+    std::vector<uint8_t> pkt;
+    while (res.rounds < 100)
+    {
+        res.rounds++;
+        uint32_t size;
+        uint16_t index;
+        uint32_t bytes = 0;
+        for (uint8_t *d = tx.getData(size, index); d != nullptr; d = tx.getData(size, index))
+        {
+            pkt.assign({(uint8_t)index, (uint8_t)(index >> 8)});
+            pkt.insert(pkt.end(), d, d + size);
+            link.send(pkt);
+            res.sent++;
+            bytes += pkt.size();
+        }
+        while (link.receive(pkt))
+            rx.addData(pkt.data(), pkt.size());
+        res.bytes += bytes;
+        res.ms += bytes / ch.bandwidth + ch.rtt;
+
+        run(rx, "{\"buf\":{\"check\":null}}", ans);
+        int empty;
+        if (!ans.getObject(1, "buf", t))
+            return res;
+        if (!ans.getArray(t, "empty", empty))
+            break; // Пустой список: все пакеты приняты.
+        std::string list;
+        for (int i : ans.elements(empty))
+        {
+            std::string text;
+            ans.getText(i, text);
+            list += (list.empty() ? "" : ",") + text;
+        }
+        run(tx, "{\"buf\":{\"get\":[" + list + "],\"only\":null}}", ans);
+    }
+    run(rx, "{\"buf\":{\"stats\":null}}", ans);
+    int stats;
+    if (ans.getObject(1, "buf", t) && ans.getObject(t, "stats", stats))
+        ans.getInt(stats, "mem", res.mem);
+    res.ok = (rx.data() != nullptr) && (std::memcmp(rx.data(), data.data(), data.size()) == 0);
+    return res;
+}
+
+/// Повторы пропущенных пакетов против пакетов четности при разных потерях.
+static void test_buf_lossy()
+{
+    std::string data(64 * 1024, '\0');
+    uint32_t seed = 1;
+    for (auto &c : data)
+    {
+        seed = seed * 1103515245 + 12345;
+        c = seed >> 16;
+    }
+    TEST_ASSERT_TRUE(CSpiffsSystem::writeFile("sim.bin", data));
+
+    static const int losses[] = {0, 1, 5, 10, 20};
+    static const int fecs[] = {0, 16, 8, 4};
+    std::printf("loss  fec  rounds  sent  overhead  KB/s   mem\n");
+    for (int loss : losses)
+    {
+        for (int fec : fecs)
+        {
+            SChannel ch = {(uint32_t)(loss * 100 + fec), loss, 1, 8, 202, 100.0, 50.0};
+            STransfer r = transfer(data, fec, ch);
+            std::printf("%3d%%  %3d  %6d  %4lu  %7.1f%%  %5.1f  %d\n", loss, fec, r.rounds, (unsigned long)r.sent,
+                        (r.bytes * 100.0 / data.size()) - 100, data.size() / r.ms * 1000 / 1024, r.mem);
+            TEST_ASSERT_TRUE_MESSAGE(r.ok, "data differs");
+            TEST_ASSERT_LESS_THAN(20, r.rounds);
+            if (loss == 0)
+                TEST_ASSERT_EQUAL(1, r.rounds);
+        }
+    }
+    std::remove(CSpiffsSystem::path("sim.bin").c_str());
+}
+
+/// Манифест пакета файлов: смещения с учётом размера манифеста, имена с escape-последовательностями.
+static void test_buf_bundle()
+{
+    std::vector<std::string> names;
+    std::string list;
+    for (int i = 0; i < 40; i++)
+    {
+        names.push_back((i == 0) ? "bnd.\"q\"" : "bnd." + std::to_string(i));
+        TEST_ASSERT_TRUE(CSpiffsSystem::writeFile(names.back(), std::string(i * 37, 'a' + i % 26)));
+        list += std::string(list.empty() ? "" : ",") + "\"" + CJsonParser::escape(names.back()) + "\"";
+    }
+    CTestBuffer tx;
+    CJsonParser ans;
+    int t;
+    int manifest = 0;
+    int size = 0;
+    run(tx, "{\"buf\":{\"rd\":[" + list + "],\"part\":16,\"fec\":4}}", ans);
+    TEST_ASSERT_TRUE(ans.getObject(1, "buf", t));
+    TEST_ASSERT_TRUE(ans.getInt(t, "manifest", manifest));
+    TEST_ASSERT_TRUE(ans.getInt(t, "size", size));
+    TEST_ASSERT_EQUAL(0, manifest % 16);
+    int fec = 0;
+    TEST_ASSERT_TRUE(ans.getInt(t, "fec", fec));
+    TEST_ASSERT_EQUAL(4, fec);
+
+    // Манифест - json, дополненный пробелами, смещения указывают на данные файлов.
+    std::string text((const char *)tx.data(), manifest);
+    CJsonParser m;
+    int files;
+    TEST_ASSERT_EQUAL(1, m.parse(text.c_str()));
+    TEST_ASSERT_TRUE(m.getArray(1, "files", files));
+    size_t i = 0;
+    int end = manifest;
+    for (int e : m.elements(files))
+    {
+        int f;
+        TEST_ASSERT_TRUE(m.getObject(e, f));
+        std::string name;
+        std::string crc;
+        int offset = 0;
+        int len = 0;
+        TEST_ASSERT_TRUE(m.getString(f, "name", name));
+        TEST_ASSERT_TRUE(m.getInt(f, "offset", offset));
+        TEST_ASSERT_TRUE(m.getInt(f, "size", len));
+        TEST_ASSERT_TRUE(m.getString(f, "crc", crc));
+        TEST_ASSERT_TRUE(i < names.size());
+        TEST_ASSERT_EQUAL_STRING(names[i].c_str(), CJsonParser::unescape(name.data(), name.size()).c_str());
+        TEST_ASSERT_EQUAL(end, offset);
+        TEST_ASSERT_EQUAL(i * 37, len);
+        TEST_ASSERT_TRUE((len == 0) || (tx.data()[offset] == (uint8_t)('a' + i % 26)));
+        char tmp[9];
+        std::sprintf(tmp, "%08lx", (unsigned long)esp_rom_crc32_le(0, &tx.data()[offset], len));
+        TEST_ASSERT_EQUAL_STRING(tmp, crc.c_str());
+        end += len;
+        i++;
+    }
+    TEST_ASSERT_EQUAL(names.size(), i);
+    TEST_ASSERT_EQUAL(size, end);
+
+    // Префикс раскодируется, пустой список файлов - ошибка.
+    run(tx, "{\"buf\":{\"rd\":\"bnd.\\\"*\",\"part\":16}}", ans);
+    TEST_ASSERT_TRUE(ans.getObject(1, "buf", t) && ans.getInt(t, "manifest", manifest));
+    text.assign((const char *)tx.data(), manifest);
+    TEST_ASSERT_EQUAL(1, m.parse(text.c_str()));
+    TEST_ASSERT_TRUE(m.getArray(1, "files", files));
+    i = 0;
+    for (int e : m.elements(files))
+    {
+        std::string name;
+        int f;
+        TEST_ASSERT_TRUE(m.getObject(e, f) && m.getString(f, "name", name));
+        TEST_ASSERT_EQUAL_STRING(names[0].c_str(), CJsonParser::unescape(name.data(), name.size()).c_str());
+        i++;
+    }
+    TEST_ASSERT_EQUAL(1, i);
+    std::string error;
+    run(tx, "{\"buf\":{\"rd\":[]}}", ans);
+    TEST_ASSERT_TRUE(ans.getObject(1, "buf", t) && ans.getString(t, "error", error));
+    for (auto &name : names)
+        std::remove(CSpiffsSystem::path(name).c_str());
+}
+
+/// Куча с выделением первого подходящего свободного участка (для сравнения с CBufferPool).
+class CFirstFit
+{
+protected:
+    uint32_t mSize;
+    std::map<uint32_t, uint32_t> mUsed; ///< Смещение - размер занятых участков.
+
+public:
+    CFirstFit(uint32_t size) : mSize(size) {};
+
+    int64_t alloc(uint32_t size)
+    {
+        uint32_t pos = 0;
+        for (auto &u : mUsed)
+        {
+            if ((u.first - pos) >= size)
+                break;
+            pos = u.first + u.second;
+        }
+        if ((mSize - pos) < size)
+            return -1;
+        mUsed[pos] = size;
+        return pos;
+    }
+    void release(uint32_t pos) { mUsed.erase(pos); }
+    /// Наибольший свободный участок.
+    uint32_t largest()
+    {
+        uint32_t pos = 0;
+        uint32_t res = 0;
+        for (auto &u : mUsed)
+        {
+            res = std::max(res, u.first - pos);
+            pos = u.first + u.second;
+        }
+        return std::max(res, mSize - pos);
+    }
+};
+
+/// Команда get: номера и диапазоны пакетов, диапазон из одного номера.
+static void test_buf_get()
+{
+    CBufferSystem buf;
+    std::vector<uint8_t> data(1000, 0x11);
+    TEST_ASSERT_TRUE(buf.load(data.data(), data.size(), 100));
+    CJsonParser ans;
+    run(buf, "{\"buf\":{\"get\":[[3],[5,6],8],\"only\":null}}", ans);
+    int t;
+    int queued = 0;
+    TEST_ASSERT_TRUE(ans.getObject(1, "buf", t) && ans.getInt(t, "queued", queued));
+    TEST_ASSERT_EQUAL(4, queued);
+    std::vector<int> order;
+    uint32_t size;
+    uint16_t index;
+    while (buf.getData(size, index) != nullptr)
+        order.push_back(index);
+    TEST_ASSERT_EQUAL(4, order.size());
+    TEST_ASSERT_TRUE((order[0] == 3) && (order[1] == 5) && (order[2] == 6) && (order[3] == 8));
+}
+
+/// Приёмник, отказывающий во второй записи.
+class CFailSink : public CBufferSink
+{
+public:
+    int writes = 0;
+
+    bool open(uint32_t size) override { return true; };
+    bool write(const uint8_t *data, uint32_t size) override { return ++writes < 2; };
+    bool commit() override { return true; };
+    std::string name() override { return "fail"; };
+};
+
+/// Ошибка приёмника в начале передачи сообщается в done и в ответе check.
+static void test_buf_sink()
+{
+    CTestBuffer buf;
+    CJsonParser ans;
+    std::vector<std::string> notes;
+    buf.setNotify([&notes](const std::string &answer)
+                  { notes.push_back(answer); });
+    buf.setSink(new CFailSink());
+    run(buf, "{\"buf\":{\"create\":400,\"part\":100,\"progress\":100}}", ans);
+    std::vector<uint8_t> pkt(102, 0);
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        pkt[0] = i;
+        buf.addData(pkt.data(), pkt.size());
+    }
+    TEST_ASSERT_EQUAL(2, notes.size());
+    TEST_ASSERT_EQUAL_STRING("\"buf\":{\"error\":\"Failed to write to sink fail\"}", notes[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("\"buf\":{\"done\":400,\"sink\":\"Failed to write to sink fail\"}", notes[1].c_str());
+    run(buf, "{\"buf\":{\"check\":null}}", ans);
+    int t;
+    std::string sink;
+    TEST_ASSERT_TRUE(ans.getObject(1, "buf", t) && ans.getString(t, "sink", sink));
+    TEST_ASSERT_EQUAL_STRING("Failed to write to sink fail", sink.c_str());
+}
+
+/// free сбрасывает счётчики приёма, производитель кольца не пишет в освобождённый буфер.
+/*!
+  Производитель работает в отдельном потоке. Без исключения между reserve/commit и free
+  запись в освобождённый буфер находит сборка с -fsanitize=address.
+*/
+static void test_buf_ring()
+{
+    CTestBuffer buf;
+    CJsonParser ans;
+    run(buf, "{\"buf\":{\"create\":1000,\"part\":100}}", ans);
+    std::vector<uint8_t> pkt(102, 0);
+    for (uint8_t i : {0, 1, 3})
+    {
+        pkt[0] = i;
+        buf.addData(pkt.data(), pkt.size());
+    }
+    TEST_ASSERT_EQUAL(200, buf.watermark());
+    TEST_ASSERT_EQUAL(1, buf.outOfOrder());
+    run(buf, "{\"buf\":{\"free\":null}}", ans);
+    TEST_ASSERT_EQUAL(0, buf.watermark());
+    TEST_ASSERT_EQUAL(0, buf.outOfOrder());
+
+    // Команда free во время записи между reserve и commit ждёт commit.
+    run(buf, "{\"buf\":{\"ring\":4096,\"part\":256}}", ans);
+    std::atomic<bool> reserved{false};
+    std::thread producer([&]()
+                         {
+        uint32_t size = 1024;
+        uint8_t *p = buf.reserve(size);
+        reserved = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        if (p != nullptr)
+        {
+            std::memset(p, 0xaa, size);
+            buf.commit(size);
+        } });
+    while (!reserved)
+        std::this_thread::yield();
+    run(buf, "{\"buf\":{\"free\":null}}", ans);
+    producer.join();
+
+    // Производитель push непрерывно, команды ring и free пересоздают буфер.
+    std::atomic<bool> stop{false};
+    producer = std::thread([&]()
+                           {
+        uint8_t block[64] = {};
+        while (!stop)
+            buf.push(block, sizeof(block)); });
+    for (int i = 0; i < 200; i++)
+    {
+        run(buf, "{\"buf\":{\"ring\":4096,\"part\":256}}", ans);
+        int t;
+        std::string ok;
+        TEST_ASSERT_TRUE(ans.getObject(1, "buf", t) && ans.getString(t, "ok", ok));
+        uint32_t size;
+        uint16_t index;
+        while (buf.getData(size, index) != nullptr)
+            ;
+        run(buf, "{\"buf\":{\"free\":null}}", ans);
+    }
+    stop = true;
+    producer.join();
+}
+
+/// Буферы передачи вперемешку с долгоживущими мелкими буферами: пул против first-fit кучи того же размера.
+/*!
+  В куче мелкие буферы остаются между освобождёнными крупными и делят свободную память на участки,
+  в пуле мелкие блоки собираются в одном выровненном блоке, а крупные объединяются.
+  Цена - округление до степени 2 (буфер 240 КБ занимает блок 256 КБ).
+*/
+static void test_buf_pool()
+{
+    const uint32_t size = 4 * 1024 * 1024;
+    const uint32_t big = 240 * 1024;
+    const uint32_t small = 8 * 1024;
+    TEST_ASSERT_TRUE(CBufferPool::init(size));
+    CFirstFit heap(size);
+    std::vector<uint8_t *> pool[2];
+    std::vector<uint32_t> pos[2];
+    for (int i = 0; i < 14; i++)
+    {
+        pool[0].push_back(CBufferPool::alloc(big));
+        pool[1].push_back(CBufferPool::alloc(small));
+        pos[0].push_back(heap.alloc(big));
+        pos[1].push_back(heap.alloc(small));
+        TEST_ASSERT_TRUE((pool[0].back() != nullptr) && (pool[1].back() != nullptr));
+        TEST_ASSERT_TRUE((pos[0].back() != (uint32_t)-1) && (pos[1].back() != (uint32_t)-1));
+    }
+    TEST_ASSERT_FALSE_MESSAGE(CBufferPool::init(size), "pool with live blocks was recreated");
+    for (int i = 0; i < 14; i++)
+    {
+        TEST_ASSERT_TRUE(CBufferPool::release(pool[0][i]));
+        heap.release(pos[0][i]);
+    }
+    uint32_t free;
+    uint32_t largest;
+    uint8_t frag = CBufferPool::stats(free, largest);
+    std::printf("        free     largest  frag\n");
+    std::printf("pool    %7lu  %7lu  %3d%%\n", (unsigned long)free, (unsigned long)largest, frag);
+    std::printf("first   %7lu  %7lu  %3d%%\n", (unsigned long)(size - 14 * small), (unsigned long)heap.largest(),
+                (int)(100 - (uint64_t)heap.largest() * 100 / (size - 14 * small)));
+    TEST_ASSERT_EQUAL(2 * 1024 * 1024, largest);
+    TEST_ASSERT_LESS_THAN(1024 * 1024, heap.largest());
+    uint8_t *ptr = CBufferPool::alloc(1024 * 1024);
+    TEST_ASSERT_TRUE(ptr != nullptr);
+    TEST_ASSERT_TRUE(heap.alloc(1024 * 1024) < 0);
+    CBufferPool::release(ptr);
+
+    for (auto p : pool[1])
+        TEST_ASSERT_TRUE(CBufferPool::release(p));
+    TEST_ASSERT_EQUAL(0, CBufferPool::stats(free, largest));
+    TEST_ASSERT_EQUAL(size, largest);
+    CBufferPool::free();
+    TEST_ASSERT_FALSE(CBufferPool::isInit());
+}
+
+void test_buf()
+{
+    CSpiffsSystem::init();
+    RUN_TEST(test_buf_lossy);
+    RUN_TEST(test_buf_bundle);
+    RUN_TEST(test_buf_get);
+    RUN_TEST(test_buf_sink);
+    RUN_TEST(test_buf_ring);
+    RUN_TEST(test_buf_pool);
+    CSpiffsSystem::free();
+}
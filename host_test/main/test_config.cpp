@@ -0,0 +1,63 @@
+/*!
+    \file
+    \brief Тесты CConfigStore: строки с escape-последовательностями, запись изменений, подписки.
+    \authors Близнец Р.А. (r.bliznets@gmail.com)
+    \version 0.1.0.0
+    \date 17.10.2026
+*/
+
+#include "CConfigStore.h"
+#include "CSpiffsSystem.h"
+#include "unity.h"
+#include "tests.h"
+#include <cstdio>
+#include <string>
+
+/// Изменённые значения записываются с сохранением форматирования файла.
+static void test_config_flush()
+{
+    TEST_ASSERT_TRUE(CSpiffsSystem::writeFile("cfg.json", "{\n  \"s\": \"a\\\\b\\u0041\",\n  \"n\": 1,\n  \"x\": null,\n  \"l\": [1, \"q\"],\n  \"k/e\": {\"v\": true}\n}\n"));
+    CConfigStore cfg("cfg.json");
+    TEST_ASSERT_TRUE(cfg.load());
+    int s = cfg.key("/s");
+    int n = cfg.key("/n");
+    int x = cfg.key("/x");
+    int l = cfg.key("/l/1");
+    int v = cfg.key("/k~1e/v");
+    TEST_ASSERT_TRUE((s >= 0) && (n >= 0) && (x >= 0) && (l >= 0) && (v >= 0));
+    TEST_ASSERT_EQUAL(-1, cfg.key("/l/2"));
+    std::string str;
+    TEST_ASSERT_TRUE(cfg.getString(s, str));
+    TEST_ASSERT_EQUAL_STRING("a\\bA", str.c_str());
+
+    // Обработчик подписки вызывается без блокировки и может читать значения.
+    int got = 0;
+    cfg.subscribe(n, [&cfg, &got](int key)
+                  { cfg.getInt(key, got); });
+    TEST_ASSERT_TRUE(cfg.setInt(n, 7));
+    TEST_ASSERT_EQUAL(7, got);
+    TEST_ASSERT_TRUE(cfg.setString(s, "q\"uo\\te\n"));
+    TEST_ASSERT_TRUE(cfg.setString(x, "new"));
+    TEST_ASSERT_TRUE(cfg.setString(l, "z"));
+    TEST_ASSERT_TRUE(cfg.setBool(v, false));
+    TEST_ASSERT_FALSE(cfg.setInt(v, 1));
+    TEST_ASSERT_TRUE(cfg.isDirty());
+    TEST_ASSERT_TRUE(cfg.flush(true));
+    TEST_ASSERT_FALSE(cfg.isDirty());
+
+    TEST_ASSERT_TRUE(CSpiffsSystem::readFile("cfg.json", str));
+    TEST_ASSERT_EQUAL_STRING("{\n  \"s\": \"q\\\"uo\\\\te\\n\",\n  \"n\": 7,\n  \"x\": \"new\",\n  \"l\": [1, \"z\"],\n  \"k/e\": {\"v\": false}\n}\n", str.c_str());
+
+    CConfigStore cfg2("cfg.json");
+    TEST_ASSERT_TRUE(cfg2.load());
+    TEST_ASSERT_TRUE(cfg2.getString(cfg2.key("/s"), str));
+    TEST_ASSERT_EQUAL_STRING("q\"uo\\te\n", str.c_str());
+    std::remove(CSpiffsSystem::path("cfg.json").c_str());
+}
+
+void test_config()
+{
+    CSpiffsSystem::init();
+    RUN_TEST(test_config_flush);
+    CSpiffsSystem::free();
+}
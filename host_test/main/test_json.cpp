@@ -0,0 +1,506 @@
+/*!
+    \file
+    \brief Тесты CJsonParser: сравнение токенов с jsmn, ошибочные строки, CBOR, JSON Patch, скорость разбора.
+    \authors Близнец Р.А. (r.bliznets@gmail.com)
+    \version 0.1.0.0
+    \date 17.10.2026
+*/
+
+#define JSMN_STATIC
+#define JSMN_PARENT_LINKS
+#include "jsmn.h"
+
+#include "CJsonParser.h"
+#include "sdkconfig.h"
+#include "unity.h"
+#include "tests.h"
+#include <cstdio>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+/// Доступ к таблице токенов.
+class CTestParser : public CJsonParser
+{
+public:
+    int count() { return mRootSize; };
+    const SJsonToken &token(int i) { return mRootTokens[i]; };
+    int sibling(int i) { return next(i); };
+    /// Поиск поля без фильтра по хешу (для сравнения скорости).
+    int findPlain(int beg, const char *name)
+    {
+        size_t len = std::strlen(name);
+        for (int i = beg; i != -1; i = next(i))
+        {
+            if ((len == mRootTokens[i].len) && (std::memcmp(name, &mJson[mRootTokens[i].start], len) == 0))
+                return i + 1;
+        }
+        return -1;
+    };
+    int findKey(int beg, const SJsonKey &name) { return find(beg, name); };
+    /// Только токенизатор, в таблицу токенов, выделенную предыдущим parse().
+    int tokens(const std::string &js) { return tokenize(js.c_str(), js.size(), mRootTokens, mRootTokensSize, false); };
+};
+
+/// Генератор случайных json документов (повторяемый при одинаковом seed).
+class CJsonGen
+{
+protected:
+    uint32_t mSeed;
+
+    uint32_t rnd(uint32_t n)
+    {
+        mSeed = mSeed * 1103515245 + 12345;
+        return (mSeed >> 8) % n;
+    }
+    void space(std::string &s)
+    {
+        static const char ws[] = " \t\r\n";
+        for (uint32_t i = rnd(3); i > 0; i--)
+            s += ws[rnd(4)];
+    }
+    void string(std::string &s)
+    {
+        static const char *esc[] = {"\\\"", "\\\\", "\\/", "\\n", "\\t", "\\u00e9"};
+        s += '"';
+        for (uint32_t i = rnd(40); i > 0; i--)
+        {
+            char c = ' ' + rnd(95);
+            if (rnd(8) == 0)
+                s += esc[rnd(6)];
+            else
+                s += ((c == '"') || (c == '\\')) ? 'x' : c;
+        }
+        s += '"';
+    }
+    void value(std::string &s, int depth)
+    {
+        space(s);
+        switch (rnd((depth < 5) ? 7 : 4))
+        {
+        case 0:
+            s += std::to_string((int)rnd(200000) - 100000);
+            break;
+        case 1:
+            s += std::to_string(rnd(1000)) + "." + std::to_string(rnd(1000)) + "e-" + std::to_string(rnd(9));
+            break;
+        case 2:
+        {
+            static const char *lit[] = {"true", "false", "null"};
+            s += lit[rnd(3)];
+            break;
+        }
+        case 3:
+            string(s);
+            break;
+        case 6:
+        {
+            s += '[';
+            for (uint32_t i = rnd(6); i > 0; i--)
+            {
+                value(s, depth + 1);
+                if (i > 1)
+                    s += ',';
+            }
+            space(s);
+            s += ']';
+            break;
+        }
+        default:
+            object(s, depth + 1, rnd(6));
+            break;
+        }
+        space(s);
+    }
+    void object(std::string &s, int depth, uint32_t n)
+    {
+        s += '{';
+        for (uint32_t i = n; i > 0; i--)
+        {
+            space(s);
+            string(s);
+            space(s);
+            s += ':';
+            value(s, depth);
+            if (i > 1)
+                s += ',';
+        }
+        space(s);
+        s += '}';
+    }
+
+public:
+    CJsonGen(uint32_t seed) : mSeed(seed) {};
+
+    /// Документ с корневым объектом из n полей.
+    std::string doc(uint32_t n)
+    {
+        std::string s;
+        space(s);
+        object(s, 0, n);
+        space(s);
+        return s;
+    }
+};
+
+/// Сравнить таблицу токенов CJsonParser с jsmn.
+/*!
+  Кроме типа и границ токенов сравниваются ссылки на соседей: ожидаемые ссылки строятся по ссылкам
+  jsmn на родителя (соседи - корневые элементы, ключи объекта и элементы массива, значение ключа
+  соседей не имеет), next() должен находить того же соседа и для ссылок JSON_TOKEN_FAR.
+*/
+static bool compare(const std::string &js)
+{
+    CTestParser p;
+    if (p.parse(js.c_str()) != 1)
+    {
+        std::printf("parse failed: %.200s\n", js.c_str());
+        return false;
+    }
+    jsmn_parser jp;
+    jsmn_init(&jp);
+    int n = jsmn_parse(&jp, js.c_str(), js.size(), nullptr, 0);
+    std::vector<jsmntok_t> tokens((n > 0) ? n : 1);
+    jsmn_init(&jp);
+    n = jsmn_parse(&jp, js.c_str(), js.size(), tokens.data(), tokens.size());
+    if (n != p.count())
+    {
+        std::printf("tokens %d, jsmn %d: %.200s\n", p.count(), n, js.c_str());
+        return false;
+    }
+    std::vector<int> sibling(n, -1);
+    std::vector<int> last(n + 1, -1); // последний потомок родителя, last[n] - корня
+    for (int i = 0; i < n; i++)
+    {
+        int parent = tokens[i].parent;
+        if ((parent != -1) && (tokens[parent].type != JSMN_OBJECT) && (tokens[parent].type != JSMN_ARRAY))
+            continue;
+        int &l = last[(parent == -1) ? n : parent];
+        if (l != -1)
+            sibling[l] = i;
+        l = i;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        static const EJsonType types[] = {JSON_PRIMITIVE, JSON_OBJECT, JSON_ARRAY, JSON_PRIMITIVE, JSON_STRING, JSON_PRIMITIVE, JSON_PRIMITIVE, JSON_PRIMITIVE, JSON_PRIMITIVE};
+        const SJsonToken &t = p.token(i);
+        if ((t.type != types[tokens[i].type]) || ((int)t.start != tokens[i].start) || ((int)(t.start + t.len) != tokens[i].end))
+        {
+            std::printf("token %d differs: %.200s\n", i, js.c_str());
+            return false;
+        }
+        int next = (sibling[i] == -1) ? 0 : std::min(sibling[i] - i, JSON_TOKEN_FAR);
+        if ((t.next != next) || (p.sibling(i) != sibling[i]))
+        {
+            std::printf("token %d next %d (%d), expected %d (%d): %.200s\n", i, (int)t.next, p.sibling(i), next, sibling[i], js.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Случайные корректные документы: токены совпадают с jsmn.
+static void test_json_random()
+{
+    for (uint32_t seed = 1; seed <= 2000; seed++)
+    {
+        CJsonGen gen(seed);
+        TEST_ASSERT_TRUE_MESSAGE(compare(gen.doc(1 + seed % 8)), "differs from jsmn");
+    }
+}
+
+/// Соседи дальше JSON_TOKEN_FAR токенов: ссылка JSON_TOKEN_FAR, next() находит соседа по границам токенов.
+static void test_json_far()
+{
+    for (int size : {JSON_TOKEN_FAR - 3, JSON_TOKEN_FAR - 2, JSON_TOKEN_FAR - 1, JSON_TOKEN_FAR, 3 * JSON_TOKEN_FAR})
+    {
+        std::string js = "{\"a\":[";
+        for (int i = 0; i < size; i++)
+            js += (i == 0) ? "0" : ",0";
+        js += "],\"b\":{\"c\":[";
+        for (int i = 0; i < size; i++)
+            js += (i == 0) ? "{\"x\":1}" : ",{\"x\":1}";
+        js += "],\"d\":\"e\"},\"f\":null}";
+        TEST_ASSERT_TRUE_MESSAGE(compare(js), "differs from jsmn");
+        CJsonParser p;
+        TEST_ASSERT_EQUAL(1, p.parse(js.c_str()));
+        int t;
+        std::string str;
+        TEST_ASSERT_TRUE(p.getObject(1, "b", t));
+        TEST_ASSERT_TRUE(p.getString(t, "d", str));
+        TEST_ASSERT_EQUAL_STRING("e", str.c_str());
+        TEST_ASSERT_TRUE(p.getField(1, "f"));
+    }
+}
+
+/// Строка с любым выравниванием адреса в памяти.
+static void test_json_alignment()
+{
+    CJsonGen gen(12345);
+    std::string js = gen.doc(16);
+    std::vector<char> buf(js.size() + 16);
+    for (size_t offset = 0; offset < 8; offset++)
+    {
+        std::memcpy(&buf[offset], js.c_str(), js.size() + 1);
+        CTestParser p;
+        TEST_ASSERT_EQUAL(1, p.parse(&buf[offset]));
+        TEST_ASSERT_TRUE(compare(std::string(&buf[offset])));
+    }
+}
+
+/// Ошибочные строки отвергаются при любом токенизаторе.
+static void test_json_invalid()
+{
+    static const char *bad[] = {
+        "{\"a\":1} {\"b\":2}",
+        "{\"a\":1},",
+        ",{\"a\":1}",
+        "{\"a\":1}]",
+        "{\"a\":1",
+        "{\"a\":[1,2}",
+        "{\"a\":\"\\x\"}",
+        "{\"a\":\"abc",
+        "{\"a\":\"abc\\u12g4\"}",
+    };
+    for (auto js : bad)
+    {
+        CJsonParser p;
+        TEST_ASSERT_TRUE_MESSAGE(p.parse(js) != 1, js);
+    }
+    CJsonParser p;
+    TEST_ASSERT_EQUAL(2, p.parseBatch("{\"a\":1}\n{\"b\":2}\n"));
+    TEST_ASSERT_EQUAL(-1, p.parseBatch("{\"a\":1},{\"b\":2}"));
+    TEST_ASSERT_EQUAL(2, p.parseBatch("[{\"a\":1},{\"b\":2}]"));
+    TEST_ASSERT_EQUAL(-1, p.parseBatch("[{\"a\":1}]\n{\"b\":2}"));
+    TEST_ASSERT_EQUAL(-1, p.parseBatch("[{\"a\":1}]\n[{\"b\":2}]"));
+}
+
+/// CBOR: теги и выход целых за диапазон int.
+static void test_json_cbor()
+{
+    // {"a": 1(5), "b": 4294967296, "c": -4294967297}
+    static const uint8_t doc[] = {0xa3, 0x61, 'a', 0xc1, 0x05,
+                                  0x61, 'b', 0x1b, 0, 0, 0, 1, 0, 0, 0, 0,
+                                  0x61, 'c', 0x3b, 0, 0, 0, 1, 0, 0, 0, 0};
+    CJsonParser p;
+    TEST_ASSERT_EQUAL(1, p.parseCbor(doc, sizeof(doc)));
+    int v = 0;
+    TEST_ASSERT_TRUE(p.getInt(1, "a", v));
+    TEST_ASSERT_EQUAL(5, v);
+    TEST_ASSERT_FALSE(p.getInt(1, "b", v));
+    TEST_ASSERT_FALSE(p.getInt(1, "c", v));
+    float f = 0;
+    TEST_ASSERT_TRUE(p.getFloat(1, "b", f));
+
+    // Длинная цепочка тегов отвергается без переполнения стека.
+    std::vector<uint8_t> tags = {0xa1, 0x61, 'a'};
+    tags.insert(tags.end(), 200000, 0xc6);
+    tags.push_back(0x01);
+    TEST_ASSERT_TRUE(p.parseCbor(tags.data(), tags.size()) != 1);
+    tags.erase(tags.begin() + 3, tags.end() - 1 - 3);
+    TEST_ASSERT_EQUAL(1, p.parseCbor(tags.data(), tags.size()));
+    TEST_ASSERT_TRUE(p.getInt(1, "a", v));
+    TEST_ASSERT_EQUAL(1, v);
+
+    // json -> CBOR: целые вне 64 бит - float, не числа - ошибка.
+    std::string cbor;
+    TEST_ASSERT_TRUE(CJsonParser::toCbor("[18446744073709551615,18446744073709551616,-9223372036854775809,-0]", 67, cbor));
+    static const uint8_t big[] = {0x9f, 0x1b, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                  0xfa, 0x5f, 0x80, 0, 0, 0xfa, 0xdf, 0, 0, 0, 0x00, 0xff};
+    TEST_ASSERT_EQUAL(sizeof(big), cbor.size());
+    TEST_ASSERT_EQUAL_MEMORY(big, cbor.data(), sizeof(big));
+    static const char *bad[] = {"[abc]", "[01]", "[1.]", "[-]", "[1e]", "[1e999]", "[0x10]"};
+    for (auto js : bad)
+        TEST_ASSERT_FALSE_MESSAGE(CJsonParser::toCbor(js, std::strlen(js), cbor), js);
+}
+
+/// JSON Patch: значение - ровно одно значение json, test сравнивает значения.
+static void test_json_patch()
+{
+    CJsonParser p;
+    TEST_ASSERT_EQUAL(1, p.parse("{\"a\":{\"x\":1,\"y\":\"\u00e9\"},\"l\":[1,2]}"));
+    std::string res;
+    static const char *bad[] = {"", " ", "1,2", "1 2", "{}]", "[1", "\"a\",\"b\""};
+    for (auto v : bad)
+        TEST_ASSERT_EQUAL_STRING_MESSAGE("bad value", p.patch("add", "/b", v, res).c_str(), v);
+    TEST_ASSERT_EQUAL_STRING("", p.patch("add", "/b", " [1,2] ", res).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"a\":{\"x\":1,\"y\":\"\u00e9\"},\"l\":[1,2],\"b\": [1,2] }", res.c_str());
+
+    TEST_ASSERT_EQUAL_STRING("", p.patch("test", "/a", "{ \"y\":\"\u00E9\", \"x\":1.0 }", res).c_str());
+    TEST_ASSERT_EQUAL_STRING("", p.patch("test", "/a/x", "1e0", res).c_str());
+    TEST_ASSERT_EQUAL_STRING("", p.patch("test", "", "{\"l\":[1,2],\"a\":{\"y\":\"\u00e9\",\"x\":1}}", res).c_str());
+    TEST_ASSERT_EQUAL_STRING("test failed /a/x", p.patch("test", "/a/x", "2", res).c_str());
+    TEST_ASSERT_EQUAL_STRING("test failed /a/x", p.patch("test", "/a/x", "\"1\"", res).c_str());
+    TEST_ASSERT_EQUAL_STRING("test failed /l", p.patch("test", "/l", "[2,1]", res).c_str());
+    TEST_ASSERT_EQUAL_STRING("test failed /a", p.patch("test", "/a", "{\"x\":1}", res).c_str());
+
+    // Ключи сравниваются раскодированными, новый ключ кодируется escape().
+    TEST_ASSERT_EQUAL(1, p.parse("{\"a\\\"b\":1,\"c\\/d\":{\"e\":2}}"));
+    TEST_ASSERT_TRUE(p.findPath("/a\"b") != -1);
+    TEST_ASSERT_TRUE(p.findPath("/c~1d/e") != -1);
+    TEST_ASSERT_EQUAL(-1, p.findPath("/c\\/d"));
+    TEST_ASSERT_EQUAL_STRING("", p.patch("replace", "/a\"b", "3", res).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"a\\\"b\":3,\"c\\/d\":{\"e\":2}}", res.c_str());
+    TEST_ASSERT_EQUAL_STRING("", p.patch("test", "/c~1d/e", "2", res).c_str());
+    TEST_ASSERT_EQUAL_STRING("", p.patch("add", "/t\t\\", "4", res).c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"a\\\"b\":1,\"c\\/d\":{\"e\":2},\"t\\t\\\\\":4}", res.c_str());
+}
+
+/// Скорость разбора документа (MB/s, лучший из нескольких проходов).
+/*!
+  Одинаковая работа: токенизатор CJsonParser (компактные токены со ссылками на соседей) и jsmn_parse
+  (токены со ссылками на родителя) заполняют заранее выделенную таблицу. parse() дополнительно
+  копирует строку и вычисляет хеши ключей, sax() не строит таблицу.
+*/
+static void bench(const char *title, const std::string &js)
+{
+    const int n = 5;
+    double best[4] = {1e9, 1e9, 1e9, 1e9};
+    auto run = [&best](int k, std::function<void()> f)
+    {
+        auto t = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++)
+            f();
+        best[k] = std::min(best[k], std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count());
+    };
+    CTestParser p;
+    TEST_ASSERT_EQUAL(1, p.parse(js.c_str()));
+    int count = p.count();
+    jsmn_parser jp;
+    jsmn_init(&jp);
+    std::vector<jsmntok_t> tokens(jsmn_parse(&jp, js.c_str(), js.size(), nullptr, 0));
+    TEST_ASSERT_EQUAL(count, tokens.size());
+    CJsonHandler h;
+    auto tokenizer = [&]()
+    { p.tokens(js); };
+    auto reference = [&]()
+    {
+        jsmn_init(&jp);
+        jsmn_parse(&jp, js.c_str(), js.size(), tokens.data(), tokens.size());
+    };
+    auto parse = [&]()
+    { p.parse(js.c_str()); };
+    auto sax = [&]()
+    { CJsonParser::sax(js.c_str(), js.size(), &h); };
+    for (int r = 0; r < 10; r++)
+    {
+        run(0, tokenizer);
+        run(1, reference);
+        run(2, parse);
+        run(3, sax);
+    }
+    TEST_ASSERT_EQUAL(count, p.tokens(js));
+#ifdef CONFIG_JSON_TOKENIZER_SWAR
+    const char *name = "SWAR";
+#else
+    const char *name = "jsmn";
+#endif
+    double mb = (double)js.size() * n / (1024 * 1024);
+    std::printf("%s: tokenizer (%s) %.1f, jsmn_parse %.1f, parse %.1f, sax %.1f MB/s\n", title, name,
+                mb / best[0], mb / best[1], mb / best[2], mb / best[3]);
+}
+
+/// Скорость разбора: случайные документы (короткие строки с частыми escape) и команды записи с hex данными.
+static void test_json_bench()
+{
+    std::string js = "{";
+    for (uint32_t seed = 1; js.size() < 256 * 1024; seed++)
+    {
+        CJsonGen gen(seed);
+        if (js.size() > 1)
+            js += ',';
+        js += "\"k" + std::to_string(seed) + "\":" + gen.doc(8);
+    }
+    js += '}';
+    bench("random", js);
+
+    js = "{";
+    uint32_t seed = 1;
+    for (int i = 0; js.size() < 256 * 1024; i++)
+    {
+        if (i != 0)
+            js += ',';
+        js += "\"c" + std::to_string(i) + "\":{\"spiffs\":{\"wr\":\"file.bin\",\"offset\":" + std::to_string(i * 256) + ",\"data\":\"";
+        for (int k = 0; k < 512; k++)
+        {
+            seed = seed * 1103515245 + 12345;
+            js += "0123456789abcdef"[(seed >> 16) & 0x0f];
+        }
+        js += "\"}}";
+    }
+    js += '}';
+    bench("hex data", js);
+}
+
+/// Совпадения 8-битного хеша ключей и скорость поиска поля.
+static void test_json_keys()
+{
+    // Случайные пары разных ключей: ожидаемая доля совпадений хешей 1/256.
+    uint32_t seed = 7;
+    auto rnd = [&seed](uint32_t n)
+    {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) % n;
+    };
+    const int pairs = 100000;
+    int same = 0;
+    for (int i = 0; i < pairs; i++)
+    {
+        std::string a;
+        std::string b;
+        for (uint32_t k = 1 + rnd(12); k > 0; k--)
+            a += (char)('a' + rnd(26));
+        for (uint32_t k = 1 + rnd(12); k > 0; k--)
+            b += (char)('a' + rnd(26));
+        if ((a != b) && (SJsonKey::calcHash(a.c_str(), a.size()) == SJsonKey::calcHash(b.c_str(), b.size())))
+            same++;
+    }
+    std::printf("8-bit key hash collisions: %.3f%% (1/256 = 0.391%%)\n", same * 100.0 / pairs);
+    TEST_ASSERT_LESS_THAN(pairs / 128, same);
+
+    // Поле в объекте из 32 полей: с фильтром по хешу и без него.
+    std::string js = "{";
+    for (int i = 0; i < 32; i++)
+        js += std::string((i == 0) ? "" : ",") + "\"field" + std::to_string(i) + "\":" + std::to_string(i);
+    js += '}';
+    CTestParser p;
+    TEST_ASSERT_EQUAL(1, p.parse(js.c_str()));
+    static constexpr SJsonKey KEY("field31");
+    const char *name = "field31";
+    TEST_ASSERT_EQUAL(64, p.findKey(1, KEY));
+    TEST_ASSERT_EQUAL(64, p.findKey(1, name));
+    TEST_ASSERT_EQUAL(64, p.findPlain(1, name));
+
+    const int n = 200000;
+    volatile int r = 0;
+    auto ns = [n](std::chrono::steady_clock::time_point t)
+    {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t).count() / n;
+    };
+    auto t = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++)
+        r = r + p.findKey(1, KEY);
+    std::printf("find, constexpr key: %.1f ns\n", ns(t));
+    t = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++)
+        r = r + p.findKey(1, name);
+    std::printf("find, runtime key: %.1f ns\n", ns(t));
+    t = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++)
+        r = r + p.findPlain(1, name);
+    std::printf("find without hash: %.1f ns\n", ns(t));
+}
+
+void test_json()
+{
+    RUN_TEST(test_json_random);
+    RUN_TEST(test_json_far);
+    RUN_TEST(test_json_alignment);
+    RUN_TEST(test_json_invalid);
+    RUN_TEST(test_json_cbor);
+    RUN_TEST(test_json_patch);
+    RUN_TEST(test_json_keys);
+    RUN_TEST(test_json_bench);
+}
@@ -0,0 +1,28 @@
+/*!
+    \file
+    \brief Запуск тестов компонента на хосте.
+    \authors Близнец Р.А. (r.bliznets@gmail.com)
+    \version 0.1.0.0
+    \date 17.10.2026
+*/
+
+#include "unity.h"
+#include "tests.h"
+#include <cstdlib>
+
+extern "C" void setUp(void)
+{
+}
+
+extern "C" void tearDown(void)
+{
+}
+
+extern "C" void app_main(void)
+{
+    UNITY_BEGIN();
+    test_json();
+    test_config();
+    test_buf();
+    std::exit(UNITY_END());
+}
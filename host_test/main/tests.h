@@ -0,0 +1,16 @@
+/*!
+	\file
+	\brief Наборы тестов компонента на хосте.
+	\authors Близнец Р.А. (r.bliznets@gmail.com)
+	\version 0.1.0.0
+	\date 17.10.2026
+*/
+
+#pragma once
+
+/// Тесты CJsonParser (json).
+void test_json();
+/// Тесты CConfigStore.
+void test_config();
+/// Тесты CBufferSystem.
+void test_buf();
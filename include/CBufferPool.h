@@ -0,0 +1,85 @@
+/*!
+	\file
+	\brief Пул памяти PSRAM для буферов.
+	\authors Близнец Р.А. (r.bliznets@gmail.com)
+	\version 0.1.0.0
+	\date 17.10.2026
+*/
+
+#pragma once
+
+#include "sdkconfig.h"
+#include <cstdint>
+#include <mutex>
+
+#define POOL_MIN_BLOCK (1024) ///< Минимальный блок пула в байтах.
+#define POOL_ORDERS (16)	  ///< Количество размеров блоков (POOL_MIN_BLOCK << 15 = 32 МБ).
+
+/// Пул памяти, резервируемый при старте, с выделением блоков методом близнецов (buddy).
+/*!
+  Исключает фрагментацию кучи PSRAM при многократном создании и удалении буферов разного размера.
+  Размер блока - степень 2, не меньше POOL_MIN_BLOCK: запрошенный размер округляется вверх,
+  поэтому буфер занимает до 2 раз больше памяти (буфер 600 КБ - блок 1 МБ). Взамен освобождённые
+  блоки всегда объединяются, и после освобождения всех буферов пул снова свободен целиком.
+*/
+class CBufferPool
+{
+protected:
+	/// Свободный блок (хранится в самом блоке).
+	struct SFree
+	{
+		SFree *prev;
+		SFree *next;
+	};
+
+	static uint8_t *mPool;			   ///< Память пула.
+	static uint32_t mSize;			   ///< Размер пула в байтах.
+	static uint8_t *mState;			   ///< Состояние блоков POOL_MIN_BLOCK: порядок начала блока (| 0x80 - свободен), 0xff - не начало блока.
+	static SFree *mFree[POOL_ORDERS];  ///< Списки свободных блоков по порядку.
+	static uint32_t mUsed;			   ///< Занято байт.
+	static std::mutex mMutex;
+
+	static void push(uint32_t block, uint8_t order);
+	static void remove(uint32_t block, uint8_t order);
+	/// Освободить память пула (вызывается под mMutex, все блоки освобождены).
+	static void clear();
+
+public:
+	/// Зарезервировать пул.
+	/*!
+	  Уже зарезервированный пул пересоздаётся, если все его блоки освобождены.
+	  \param[in] size размер пула в байтах.
+	  \return true в случае успеха, false если в пуле есть выделенные блоки
+	*/
+	static bool init(uint32_t size = CONFIG_BUF_POOL_SIZE * 1024);
+	/// Освободить пул.
+	/*!
+	  Вызывается только после освобождения всех блоков (release), иначе пул не освобождается
+	  и выдаётся ошибка в лог - выделенные блоки остаются действительными.
+	*/
+	static void free();
+	/// Пул зарезервирован.
+	static inline bool isInit() { return (mPool != nullptr); };
+
+	/// Выделить блок.
+	/*!
+	  Размер округляется вверх до POOL_MIN_BLOCK * 2^n.
+	  \param[in] size размер в байтах.
+	  \return указатель на блок, либо nullptr
+	*/
+	static uint8_t *alloc(uint32_t size);
+	/// Освободить блок.
+	/*!
+	  \param[in] ptr указатель на блок.
+	  \return false если блок не из пула
+	*/
+	static bool release(uint8_t *ptr);
+
+	/// Статистика пула.
+	/*!
+	  \param[out] free свободно байт (с учётом округления размеров блоков).
+	  \param[out] largest наибольший свободный блок в байтах.
+	  \return фрагментация в процентах (100 - largest * 100 / free)
+	*/
+	static uint8_t stats(uint32_t &free, uint32_t &largest);
+};
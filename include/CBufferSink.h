@@ -0,0 +1,118 @@
+/*!
+	\file
+	\brief Приёмники данных буфера PSRAM.
+	\authors Близнец Р.А. (r.bliznets@gmail.com)
+	\version 0.1.0.0
+	\date 17.10.2026
+*/
+
+#pragma once
+
+#include "sdkconfig.h"
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <functional>
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include "esp_partition.h"
+#endif
+
+/// Приёмник данных буфера.
+/*!
+  Данные передаются последовательно по мере приёма непрерывной последовательности пакетов.
+*/
+class CBufferSink
+{
+public:
+	virtual ~CBufferSink() = default;
+
+	/// Начать запись.
+	/*!
+	  \param[in] size размер данных в байтах.
+	  \return true в случае успеха
+	*/
+	virtual bool open(uint32_t size) = 0;
+	/// Записать следующую часть данных.
+	/*!
+	  \param[in] data данные.
+	  \param[in] size размер данных в байтах.
+	  \return true в случае успеха
+	*/
+	virtual bool write(const uint8_t *data, uint32_t size) = 0;
+	/// Завершить запись после приёма всех данных.
+	/*!
+	  \return true в случае успеха
+	*/
+	virtual bool commit() = 0;
+	/// Отменить незавершённую запись.
+	virtual void cancel() {};
+	/// Описание приёмника для ответа.
+	virtual std::string name() = 0;
+};
+
+/// Файл SPIFFS, записывается через транзакцию (<имя_файла>$).
+class CFileSink : public CBufferSink
+{
+protected:
+	std::string mFileName;
+	FILE *mFile = nullptr;
+
+public:
+	CFileSink(const std::string &fname) : mFileName(fname) {};
+	~CFileSink() { cancel(); };
+
+	bool open(uint32_t size) override;
+	bool write(const uint8_t *data, uint32_t size) override;
+	bool commit() override;
+	void cancel() override;
+	std::string name() override { return mFileName; };
+};
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+/// Область раздела flash, стирается при открытии.
+class CPartitionSink : public CBufferSink
+{
+protected:
+	std::string mLabel;
+	uint32_t mOffset;
+	const esp_partition_t *mPartition = nullptr;
+	uint32_t mPos = 0;
+
+public:
+	/// Конструктор.
+	/*!
+	  \param[in] label метка раздела.
+	  \param[in] offset смещение в разделе (кратно размеру сектора 4096).
+	*/
+	CPartitionSink(const std::string &label, uint32_t offset = 0) : mLabel(label), mOffset(offset) {};
+
+	bool open(uint32_t size) override;
+	bool write(const uint8_t *data, uint32_t size) override;
+	bool commit() override { return (mPartition != nullptr); };
+	std::string name() override { return mLabel; };
+};
+#endif
+
+/// Функция прошивки.
+class CCallbackSink : public CBufferSink
+{
+public:
+	/// Функция записи.
+	/*!
+	  \param[in] data данные, nullptr - все данные переданы.
+	  \param[in] size размер данных в байтах.
+	  \return true в случае успеха
+	*/
+	using TWrite = std::function<bool(const uint8_t *data, uint32_t size)>;
+
+protected:
+	TWrite mWrite;
+
+public:
+	CCallbackSink(TWrite write) : mWrite(write) {};
+
+	bool open(uint32_t size) override { return (bool)mWrite; };
+	bool write(const uint8_t *data, uint32_t size) override { return mWrite(data, size); };
+	bool commit() override { return mWrite(nullptr, 0); };
+	std::string name() override { return "callback"; };
+};
@@ -10,11 +10,45 @@
 
 #include "sdkconfig.h"
 #include "CJsonParser.h"
+#include "CBufferSink.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#include <vector>
 
 #define BUF_PART_SIZE (200)
+#define BUF_PART_QUEUED (2) ///< Состояние пакета в mParts: запрошен командой get (передаётся первым).
 
 class CBufferSystem
 {
+public:
+	/// Обработчик приёма пакетов.
+	/*!
+	  \param[in] percent процент принятых пакетов (100 - все пакеты приняты).
+	*/
+	using THandler = std::function<void(uint8_t percent)>;
+	/// Передача сообщения хосту без команды.
+	/*!
+	  \param[in] answer json строка (без обрамления в начале и конце {}).
+	*/
+	using TNotify = std::function<void(const std::string &answer)>;
+
+	/// Статистика передачи.
+	struct SStats
+	{
+		uint32_t parts;		 ///< Принято/передано пакетов, включая пакеты четности и повторы.
+		uint32_t bytes;		 ///< Принято/передано байт данных в пакетах.
+		uint32_t duplicates; ///< Повторно принятых пакетов.
+		uint32_t errors;	 ///< Пакетов с неверным размером или номером.
+		uint32_t checks;	 ///< Команд check (циклов запрос-ответ).
+		TickType_t start;	 ///< Время создания буфера.
+		TickType_t time;	 ///< Длительность приёма всех пакетов (0 - приём не завершён).
+	};
+
 protected:
 	uint8_t *mBuffer = nullptr;
 	uint32_t mSize;
@@ -23,8 +57,81 @@ protected:
 	uint16_t mLastPart;
 	bool mRead = false;
 
+	bool mRing = false;					 ///< Кольцевой режим.
+	uint32_t mWrite = 0;				 ///< Смещение записи в кольце.
+	uint32_t mReadPos = 0;				 ///< Смещение чтения в кольце.
+	std::atomic<uint32_t> mUsed{0};		 ///< Занято байт в кольце (включая передаваемый пакет).
+	std::atomic<uint32_t> mOverrun{0};	 ///< Количество потерянных блоков из-за переполнения.
+	bool mSending = false;				 ///< Пакет передаётся (освобождается при следующем getData).
+	uint16_t mSeq = 0;					 ///< Номер следующего пакета кольца.
+	std::mutex mRingMutex;				 ///< Исключение освобождения буфера во время push и между reserve и commit.
+
+	uint16_t mFec = 0;					 ///< Количество пакетов в группе с пакетом четности (0 - без четности).
+	uint16_t mGroups = 0;				 ///< Количество групп (пакетов четности).
+	uint8_t *mParity = nullptr;			 ///< Пакеты четности.
+	uint32_t mRecovered = 0;			 ///< Количество восстановленных пакетов.
+
+	uint32_t mReceived = 0;				 ///< Количество принятых пакетов данных.
+	uint32_t mContiguous = 0;			 ///< Количество принятых подряд с начала буфера пакетов.
+	THandler mHandler;					 ///< Обработчик приёма пакетов.
+	uint8_t mStep = 100;				 ///< Шаг процентов для обработчика.
+	uint8_t mPercent = 0;				 ///< Последний процент для обработчика.
+	EventGroupHandle_t mEvents = nullptr; ///< Группа событий завершения приёма.
+	EventBits_t mBits = 0;				 ///< Биты группы событий.
+	TNotify mNotify;					 ///< Передача сообщений хосту.
+	uint8_t mNotifyStep = 0;			 ///< Шаг процентов для сообщений хосту (0 - без сообщений).
+	uint8_t mNotifyPercent = 0;			 ///< Последний процент для сообщений хосту.
+
+	std::unique_ptr<CBufferSink> mSink;	 ///< Приёмник данных текущей передачи.
+	std::unique_ptr<CBufferSink> mNextSink; ///< Приёмник данных для следующей команды create.
+	uint32_t mFlushed = 0;				 ///< Количество пакетов, переданных приёмнику.
+	std::string mSinkError;				 ///< Ошибка приёмника текущей передачи ("" - нет ошибки).
+
+	uint32_t mQueued = 0;				 ///< Количество пакетов, запрошенных командой get (BUF_PART_QUEUED в mParts).
+	uint32_t mQueuePos = 0;				 ///< Номер пакета, с которого ищутся запрошенные пакеты.
+	SStats mStats = {};					 ///< Статистика передачи.
+
 	bool init(uint32_t size);
 	void free();
+	/// Разбить буфер на пакеты.
+	/*!
+	  \param[in] part размер пакета в байтах (1..65535).
+	  \param[in] fec количество пакетов в группе с пакетом четности (0 - без четности, не больше количества пакетов).
+	  \param[in] fill начальное состояние пакетов (1 - пакет есть).
+	  \return true в случае успеха
+	*/
+	bool split(int part, int fec, uint8_t fill);
+	/// Последний пакет данных группы четности.
+	inline uint16_t groupLast(uint16_t group) { return std::min<uint32_t>((group + 1U) * mFec - 1, mLastPart); };
+	/// Размер пакета данных.
+	inline uint32_t partSize(uint16_t i) { return (i < mLastPart) ? mPart : (mSize - mLastPart * mPart); };
+	/// Учесть принятый пакет данных и выдать события.
+	void received();
+	/// Передать приёмнику непрерывную последовательность принятых пакетов.
+	/*!
+	  Ошибка сохраняется в mSinkError до конца передачи, приёмник удаляется.
+	  \return "" если приёмника нет, иначе результат записи ("ok" после завершения)
+	*/
+	std::string flush();
+	/// Вычислить пакет четности группы.
+	void parity(uint16_t group, uint8_t *res);
+	/// Восстановить единственный пропущенный пакет группы по пакету четности.
+	void recover(uint16_t group);
+	/// Собрать новый файл по разнице из буфера и блоков старого файла.
+	/*!
+	  \param[in] fname имя файла.
+	  \param[in] block размер блока старого файла.
+	  \return json строка с результатом (без обрамления {})
+	*/
+	std::string delta(const std::string &fname, uint32_t block);
+	/// Загрузить несколько файлов в буфер с манифестом в начале.
+	/*!
+	  \param[in] names имена файлов (без escape-последовательностей json).
+	  \param[in] part размер пакета в байтах.
+	  \param[in] fec количество пакетов в группе с пакетом четности.
+	  \return json строка с результатом (без обрамления {})
+	*/
+	std::string bundle(const std::vector<std::string> &names, int part, int fec);
 
 public:
 	~CBufferSystem()
@@ -35,9 +142,91 @@ public:
 	/// Обработка команды.
 	/*!
 	  \param[in] cmd json объектом spiffs в корне.
+	  \param[in] beg индекс первого токена объекта команды (для пакета команд).
 	  \return json строка с ответом (без обрамления в начале и конце {}), либо "".
 	*/
-	std::string command(CJsonParser *cmd, bool& cancel);
+	std::string command(CJsonParser *cmd, bool& cancel, int beg = 1);
 	void addData(uint8_t* data, uint32_t size);
 	uint8_t* getData(uint32_t& size, uint16_t& index);
+
+	/// Загрузить данные в буфер для передачи по 2-му каналу (как команда rd).
+	/*!
+	  \param[in] data данные.
+	  \param[in] size размер данных в байтах.
+	  \param[in] part размер пакета в байтах.
+	  \return true в случае успеха
+	*/
+	bool load(const uint8_t *data, uint32_t size, uint16_t part = BUF_PART_SIZE);
+
+	/// Создать кольцевой буфер для непрерывной передачи.
+	/*!
+	  Размер округляется вниз до кратного размеру пакета, getData выдаёт только полные пакеты
+	  с последовательными номерами (по модулю 65536).
+	  \param[in] size размер буфера в байтах.
+	  \param[in] part размер пакета в байтах.
+	  \return true в случае успеха
+	*/
+	bool ring(uint32_t size, uint16_t part = BUF_PART_SIZE);
+	/// Добавить блок данных в кольцевой буфер.
+	/*!
+	  Один производитель и один потребитель (getData) могут работать из разных задач без блокировок между собой.
+	  Команды free/create/ring освобождают буфер только после выхода производителя из push.
+	  Если места нет, блок отбрасывается целиком и учитывается в счётчике переполнений.
+	  \param[in] data данные.
+	  \param[in] size размер данных в байтах.
+	  \return true если блок добавлен
+	*/
+	bool push(const uint8_t *data, uint32_t size);
+	/// Получить место в кольцевом буфере для записи без копирования.
+	/*!
+	  После успешного вызова буфер не освобождается до вызова commit, поэтому commit обязателен (commit(0) - отказ от записи).
+	  \param[in,out] size запрашиваемый размер, после вызова - доступный непрерывный размер (не больше запрошенного).
+	  \return указатель для записи, либо nullptr (нет места, учитывается в счётчике переполнений)
+	*/
+	uint8_t *reserve(uint32_t &size);
+	/// Подтвердить запись в место, полученное reserve.
+	/*!
+	  \param[in] size количество записанных байт.
+	*/
+	void commit(uint32_t size);
+	/// Задать обработчик приёма пакетов.
+	/*!
+	  Вызывается из задачи, вызывающей addData.
+	  \param[in] handler обработчик.
+	  \param[in] step шаг процентов (100 - только завершение).
+	*/
+	void setHandler(THandler handler, uint8_t step = 100);
+	/// Задать группу событий, в которой устанавливаются биты при приёме всех пакетов.
+	/*!
+	  \param[in] group группа событий.
+	  \param[in] bits биты.
+	*/
+	void setEventGroup(EventGroupHandle_t group, EventBits_t bits);
+	/// Задать функцию передачи сообщений хосту.
+	/*!
+	  Сообщения "buf":{"progress":...} и "buf":{"done":...} передаются, если в команде create задано "progress".
+	  \param[in] notify функция передачи.
+	*/
+	void setNotify(TNotify notify);
+
+	/// Задать приёмник данных для следующей команды create.
+	/*!
+	  Приёмник удаляется после завершения или отмены передачи.
+	  \param[in] sink приёмник.
+	*/
+	void setSink(CBufferSink *sink) { mNextSink.reset(sink); };
+
+	/// Размер принятых подряд с начала буфера данных.
+	/*!
+	  Данные до этого смещения можно обрабатывать, не дожидаясь приёма всего буфера.
+	  \return размер в байтах
+	*/
+	inline uint32_t watermark() { return std::min(mContiguous * mPart, mSize); };
+	/// Количество принятых пакетов данных за пределами непрерывной части.
+	inline uint32_t outOfOrder() { return mReceived - mContiguous; };
+
+	/// Статистика последней передачи.
+	inline const SStats &stats() { return mStats; };
+	/// Количество потерянных блоков из-за переполнения кольцевого буфера.
+	inline uint32_t overrun() { return mOverrun; };
 };
@@ -0,0 +1,160 @@
+/*!
+	\file
+	\brief Класс хранилища настроек из json файла SPIFFS.
+	\authors Близнец Р.А. (r.bliznets@gmail.com)
+	\version 0.1.0.0
+	\date 17.10.2026
+*/
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "CJsonParser.h"
+#include "freertos/FreeRTOS.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+
+/// Хранилище настроек.
+/*!
+  Файл читается и разбирается один раз, значения хранятся в RAM в типизированном виде.
+  Доступ к значению по ключу (индексу), полученному при инициализации методом key().
+  Изменения записываются в файл отложенно (flush), несколько изменений объединяются в одну запись.
+  Строки хранятся раскодированными, при записи в файл кодируются escape-последовательностями.
+  Текст файла в RAM не хранится, для значения хранится только хеш пути. Методы потокобезопасны,
+  обработчики подписок вызываются без блокировки хранилища.
+*/
+class CConfigStore
+{
+public:
+	/// Обработчик изменения значения.
+	/*!
+	  \param[in] key ключ изменённого значения.
+	*/
+	using THandler = std::function<void(int key)>;
+
+protected:
+	/// Значение настройки.
+	struct SValue
+	{
+		uint32_t hash;			///< Хеш пути JSON Pointer.
+		SJsonField::EKind kind; ///< Тип значения (NONE - null).
+		bool dirty;			 ///< Значение изменено и не записано в файл.
+		union
+		{
+			int i;
+			float f;
+			bool b;
+		};
+		std::string s;
+	};
+	/// Подписка на изменения.
+	struct SSubscriber
+	{
+		int id;			  ///< Идентификатор подписки.
+		int key;		  ///< Ключ, либо -1 для всех значений.
+		THandler handler; ///< Обработчик.
+	};
+
+	std::string mFileName;					///< Имя файла.
+	std::vector<SValue> mValues;			///< Значения в порядке файла.
+	std::vector<SSubscriber> mSubscribers;	///< Подписки.
+	int mNextId = 0;						///< Идентификатор следующей подписки.
+	bool mDirty = false;					///< Есть незаписанные изменения.
+	TickType_t mChangeTime = 0;				///< Время последнего изменения.
+	std::mutex mMutex;
+
+	/// Хеш пути (FNV-1a).
+	static uint32_t hash(const std::string &path);
+	/// Обойти значения json (кроме объектов и массивов) в порядке файла.
+	/*!
+	  \param[in] doc разобранный файл.
+	  \param[in] i индекс токена значения.
+	  \param[in] path путь значения.
+	  \param[in] handler обработчик: индекс токена и хеш пути значения.
+	*/
+	static void walk(CJsonParser &doc, int i, const std::string &path, const std::function<void(int i, uint32_t hash)> &handler);
+	/// Найти значение по хешу пути.
+	/*!
+	  \param[in] hash хеш пути.
+	  \param[in] hint ожидаемый индекс.
+	  \return ключ, либо -1
+	*/
+	int find(uint32_t hash, int hint);
+	/// Json текст значения для записи в файл.
+	static std::string text(const SValue &value);
+	/// Изменить значение.
+	/*!
+	  \param[in] key ключ.
+	  \param[in] kind тип нового значения.
+	  \param[in] value указатель на новое значение.
+	  \return true в случае успеха
+	*/
+	bool change(int key, SJsonField::EKind kind, const void *value);
+
+public:
+	/// Конструктор.
+	/*!
+	  \param[in] fname имя файла в SPIFFS.
+	*/
+	CConfigStore(const std::string &fname) : mFileName(fname) {};
+	/// Деструктор, записывает незаписанные изменения.
+	~CConfigStore();
+
+	/// Загрузить файл.
+	/*!
+	  Ранее полученные ключи становятся недействительными.
+	  \return true в случае успеха
+	*/
+	bool load();
+	/// Получить ключ значения.
+	/*!
+	  Поиск линейный по хешу пути, ключ следует получать один раз при инициализации.
+	  \param[in] path путь JSON Pointer, например "/wifi/ssid".
+	  \return ключ, либо -1
+	*/
+	int key(const std::string &path);
+
+	bool getInt(int key, int &value);
+	bool getFloat(int key, float &value);
+	bool getBool(int key, bool &value);
+	bool getString(int key, std::string &value);
+	bool isNull(int key);
+
+	/// Изменить значение.
+	/*!
+	  Число можно заменить числом, null - любым значением, остальные значения - только значением того же типа.
+	  \param[in] key ключ.
+	  \param[in] value новое значение.
+	  \return true в случае успеха
+	*/
+	bool setInt(int key, int value) { return change(key, SJsonField::INT, &value); };
+	bool setFloat(int key, float value) { return change(key, SJsonField::FLOAT, &value); };
+	bool setBool(int key, bool value) { return change(key, SJsonField::BOOL, &value); };
+	bool setString(int key, const std::string &value) { return change(key, SJsonField::STRING, &value); };
+
+	/// Подписаться на изменения.
+	/*!
+	  \param[in] key ключ, либо -1 для всех значений.
+	  \param[in] handler обработчик.
+	  \return идентификатор подписки
+	*/
+	int subscribe(int key, THandler handler);
+	/// Отменить подписку.
+	/*!
+	  \param[in] id идентификатор подписки.
+	*/
+	void unsubscribe(int id);
+
+	/// Записать изменения в файл.
+	/*!
+	  Без force запись выполняется, если с последнего изменения прошло CONFIG_JSON_CONFIG_DELAY мс.
+	  Вызывается периодически из цикла задачи.
+	  \param[in] force записать немедленно.
+	  \return true если изменений нет или они записаны
+	*/
+	bool flush(bool force = false);
+	/// Есть незаписанные изменения.
+	bool isDirty();
+};
@@ -0,0 +1,137 @@
+/*!
+	\file
+	\brief Файловые системы для CSpiffsSystem.
+	\authors Близнец Р.А. (r.bliznets@gmail.com)
+	\version 0.1.0.0
+	\date 17.10.2026
+*/
+
+#pragma once
+
+#include "sdkconfig.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// Файловая система, подключаемая в VFS.
+/*!
+  Команды CSpiffsSystem работают с файлами через VFS (fopen, opendir и т.д.) по пути base(),
+  файловая система отвечает только за монтирование и обслуживание раздела.
+  Выбирается в sdkconfig (CONFIG_FS_*).
+*/
+class CFsBackend
+{
+protected:
+	std::string mBase;	///< Путь монтирования.
+	std::string mLabel; ///< Метка раздела (пустая - первый подходящий).
+
+	/// Метка раздела для esp_* функций.
+	inline const char *label() { return mLabel.empty() ? nullptr : mLabel.c_str(); };
+
+public:
+	/// Конструктор.
+	/*!
+	  \param[in] base путь монтирования.
+	  \param[in] label метка раздела.
+	*/
+	CFsBackend(const std::string &base, const std::string &label) : mBase(base), mLabel(label) {};
+	virtual ~CFsBackend() = default;
+
+	/// Создать файловую систему, выбранную в sdkconfig.
+	static CFsBackend *create();
+
+	/// Смонтировать (с форматированием при ошибке).
+	/*!
+	  \return true в случае успеха
+	*/
+	virtual bool mount() = 0;
+	/// Размонтировать.
+	virtual void unmount() = 0;
+	/// Проверить на ошибки.
+	/*!
+	  \return true в случае успеха
+	*/
+	virtual bool check() { return true; };
+	/// Сборка мусора (подготовка свободных блоков).
+	virtual void gc() {};
+	/// Размер раздела.
+	/*!
+	  \param[out] total всего байт.
+	  \param[out] used занято байт.
+	  \return true в случае успеха
+	*/
+	virtual bool info(size_t &total, size_t &used) = 0;
+	/// Форматировать.
+	/*!
+	  \return true в случае успеха
+	*/
+	virtual bool format() = 0;
+	/// Название файловой системы для ответа.
+	virtual const char *name() = 0;
+
+	/// Путь монтирования.
+	inline const std::string &base() { return mBase; };
+};
+
+#ifdef CONFIG_FS_SPIFFS
+/// SPIFFS.
+class CSpiffsBackend : public CFsBackend
+{
+public:
+	using CFsBackend::CFsBackend;
+	bool mount() override;
+	void unmount() override;
+	bool check() override;
+	void gc() override;
+	bool info(size_t &total, size_t &used) override;
+	bool format() override;
+	const char *name() override { return "spiffs"; };
+};
+#endif
+
+#ifdef CONFIG_FS_LITTLEFS
+/// LittleFS (компонент joltwallet/littlefs).
+class CLittleFsBackend : public CFsBackend
+{
+public:
+	using CFsBackend::CFsBackend;
+	bool mount() override;
+	void unmount() override;
+	bool info(size_t &total, size_t &used) override;
+	bool format() override;
+	const char *name() override { return "littlefs"; };
+};
+#endif
+
+#ifdef CONFIG_FS_FAT
+#include "wear_levelling.h"
+
+/// FAT с выравниванием износа.
+class CFatBackend : public CFsBackend
+{
+protected:
+	wl_handle_t mWl = WL_INVALID_HANDLE;
+
+public:
+	using CFsBackend::CFsBackend;
+	bool mount() override;
+	void unmount() override;
+	bool info(size_t &total, size_t &used) override;
+	bool format() override;
+	const char *name() override { return "fat"; };
+};
+#endif
+
+#ifdef CONFIG_FS_POSIX
+/// Каталог файловой системы хоста (linux target), монтирование не требуется.
+class CPosixBackend : public CFsBackend
+{
+public:
+	using CFsBackend::CFsBackend;
+	bool mount() override;
+	void unmount() override {};
+	bool info(size_t &total, size_t &used) override;
+	bool format() override;
+	const char *name() override { return "posix"; };
+};
+#endif
@@ -16,6 +16,159 @@
 
 #include <string>
 #include <cstring>
+#include <cstdint>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+#include <functional>
+
+#define JSON_TOKEN_FAR (0x3fff) ///< Значение ссылки на соседа, не помещающейся в поле next.
+
+/// Тип токена.
+enum EJsonType
+{
+	JSON_OBJECT = 0,   ///< Объект.
+	JSON_ARRAY = 1,	   ///< Массив.
+	JSON_STRING = 2,   ///< Строка.
+	JSON_PRIMITIVE = 3 ///< Число, true, false, null.
+};
+
+/// Компактный токен (8 байт).
+/*!
+  Поля объекта идут парами ключ-значение (значение = ключ + 1).
+  Ключи одного объекта и элементы одного массива связаны ссылкой next.
+*/
+struct SJsonToken
+{
+	uint64_t start : 24; ///< Смещение в строке.
+	uint64_t len : 24;	 ///< Длина.
+	uint64_t type : 2;	 ///< Тип EJsonType.
+	uint64_t next : 14;	 ///< Смещение до следующего соседа (0 - нет соседа, JSON_TOKEN_FAR - дальше поля).
+};
+
+#ifdef __cpp_consteval
+#define JSON_KEY_CONSTEVAL consteval ///< Хеш ключа из литерала только при компиляции (C++20).
+#else
+#define JSON_KEY_CONSTEVAL constexpr ///< До C++20 хеш при компиляции гарантирован только для static constexpr SJsonKey.
+#endif
+
+/// Ключ поля json с длиной и хешем.
+/*!
+  Для строковых литералов длина и хеш вычисляются при компиляции (в C++20 конструктор consteval,
+  до C++20 - гарантированно при объявлении static constexpr SJsonKey KEY("name")).
+  Изменяемый массив char и указатель - расчет при выполнении; const массив, не являющийся константой
+  времени компиляции, в C++20 не компилируется (передавать как const char*).
+
+  Хеш 8 бит - только фильтр перед сравнением строк в CJsonParser::find, совпадение хешей разных ключей
+  стоит одного лишнего memcmp (вероятность 1/256). Замер частоты совпадений и скорости поиска - host_test (test_json_keys).
+*/
+struct SJsonKey
+{
+	const char *name; ///< Название поля.
+	uint32_t len;	  ///< Длина названия.
+	uint8_t hash;	  ///< Хеш названия.
+
+	/// Длина строки не больше size.
+	static constexpr uint32_t calcLen(const char *str, size_t size)
+	{
+		uint32_t i = 0;
+		while ((i < size) && (str[i] != 0))
+			i++;
+		return i;
+	}
+	/// Хеш строки (FNV-1a, свернутый до 8 бит).
+	static constexpr uint8_t calcHash(const char *str, uint32_t len)
+	{
+		uint32_t h = 2166136261u;
+		for (uint32_t i = 0; i < len; i++)
+			h = (h ^ (uint8_t)str[i]) * 16777619u;
+		return (uint8_t)(h ^ (h >> 8) ^ (h >> 16) ^ (h >> 24));
+	}
+
+	/// Ключ из строкового литерала.
+	template <size_t N>
+	JSON_KEY_CONSTEVAL SJsonKey(const char (&str)[N]) : name(str), len(calcLen(str, N)), hash(calcHash(str, calcLen(str, N))) {};
+	/// Ключ из строки, длина и хеш вычисляются при выполнении.
+	template <typename T, typename = typename std::enable_if<std::is_same<T, const char *>::value || std::is_same<T, char *>::value>::type>
+	SJsonKey(T str) : name(str), len(std::strlen(str)), hash(calcHash(str, std::strlen(str))) {};
+	/// Ключ из изменяемого массива char (буфер), длина и хеш вычисляются при выполнении.
+	template <size_t N>
+	SJsonKey(char (&str)[N]) : SJsonKey((const char *)str) {};
+};
+
+/// Описание поля для CJsonParser::getMany.
+struct SJsonField
+{
+	/// Тип значения поля.
+	enum EKind
+	{
+		NONE,	///< null.
+		STRING, ///< std::string.
+		INT,	///< int.
+		FLOAT,	///< float.
+		BOOL	///< bool.
+	};
+
+	SJsonKey key; ///< Название поля.
+	EKind kind;	  ///< Тип значения.
+	void *value;  ///< Указатель на значение.
+
+	/// Поле null.
+	SJsonField(const SJsonKey &key) : key(key), kind(NONE), value(nullptr) {};
+	/// Строковое поле.
+	SJsonField(const SJsonKey &key, std::string *value) : key(key), kind(STRING), value(value) {};
+	/// Поле int.
+	SJsonField(const SJsonKey &key, int *value) : key(key), kind(INT), value(value) {};
+	/// Поле float.
+	SJsonField(const SJsonKey &key, float *value) : key(key), kind(FLOAT), value(value) {};
+	/// Логическое поле.
+	SJsonField(const SJsonKey &key, bool *value) : key(key), kind(BOOL), value(value) {};
+};
+
+/// Обработчик событий потокового разбора json.
+/*!
+  Строки передаются без раскодирования escape-последовательностей, указатели действительны только внутри вызова.
+  Возврат false прерывает разбор.
+*/
+class CJsonHandler
+{
+public:
+	virtual ~CJsonHandler() {};
+
+	/// Начало объекта.
+	virtual bool onBeginObject() { return true; };
+	/// Конец объекта.
+	virtual bool onEndObject() { return true; };
+	/// Начало массива.
+	virtual bool onBeginArray() { return true; };
+	/// Конец массива.
+	virtual bool onEndArray() { return true; };
+	/// Ключ поля объекта.
+	/*!
+	  \param[in] str начало ключа.
+	  \param[in] len длина ключа.
+	*/
+	virtual bool onKey(const char *str, size_t len) { return true; };
+	/// Строковое значение.
+	/*!
+	  \param[in] str начало строки.
+	  \param[in] len длина строки.
+	*/
+	virtual bool onString(const char *str, size_t len) { return true; };
+	/// Числовое значение.
+	/*!
+	  \param[in] str начало числа.
+	  \param[in] len длина числа.
+	*/
+	virtual bool onNumber(const char *str, size_t len) { return true; };
+	/// Логическое значение.
+	virtual bool onBool(bool value) { return true; };
+	/// Значение null.
+	virtual bool onNull() { return true; };
+};
+
+template <typename T>
+class CJsonRange;
 
 /// Класс для разбора json строки.
 /*!
@@ -24,12 +177,91 @@
 class CJsonParser
 {
 protected:
-	jsmn_parser mParser;	///< Данные парсера.
-	jsmntok_t *mRootTokens; ///< Массив токенов.
-	int mRootTokensSize;	///< Размер массива токенов.
-	int mRootSize;			///< Количество токенов в массиве.
+	jsmn_parser mParser;	  ///< Данные парсера.
+	SJsonToken *mRootTokens; ///< Массив токенов.
+	uint8_t *mKeyHashes;	  ///< Хеши ключей объектов (по индексу токена).
+	int mRootTokensSize;	  ///< Размер массива токенов.
+	jsmntok_t *mJsmnTokens = nullptr; ///< Таблица jsmn размера mRootTokensSize (только токенизатор jsmn).
+	int mRootSize;			  ///< Количество токенов в массиве.
 
 	std::string mJson; ///< Парсируемая строка.
+	bool mCbor = false; ///< Разобраны данные CBOR.
+	int mBatch = -1;	///< Индекс первой команды пакета, либо -1.
+
+	/// Разбор строки на токены выбранным в sdkconfig токенизатором.
+	/*!
+	  \param[in] json Парсируемая строка.
+	  \param[in] len Длина строки.
+	  \param[out] tokens Массив токенов (nullptr - только подсчет токенов).
+	  \param[in] num Размер массива токенов, не больше mRootTokensSize.
+	  \param[in] multi разрешить несколько корневых элементов (NDJSON).
+	  \return количество токенов, либо код ошибки JSMN_ERROR_*
+	*/
+	int tokenize(const char *json, size_t len, SJsonToken *tokens, unsigned int num, bool multi);
+	/// Парсинг команды или пакета команд.
+	/*!
+	  \param[in] json Парсируемая строка.
+	  \param[in] batch разрешить пакет команд.
+	  \return 1 в случае успеха, иначе ошибка
+	*/
+	int parse(const char *json, bool batch);
+	/// Изменить размер массива токенов.
+	/*!
+	  \param[in] num новый размер.
+	  \return true в случае успеха
+	*/
+	bool resize(int num);
+	/// Проверка результата разбора и расчет хешей ключей.
+	/*!
+	  \param[in] data разобранные данные.
+	  \param[in] len размер данных.
+	  \param[in] batch разрешить пакет команд.
+	  \return 1 в случае успеха, иначе ошибка
+	*/
+	int result(const char *data, size_t len, bool batch);
+
+	/// Следующий соседний токен.
+	/*!
+	  \param[in] i индекс ключа объекта или элемента массива.
+	  \return индекс следующего ключа/элемента, либо -1
+	*/
+	int next(int i);
+	/// Поиск значения поля.
+	/*!
+	  \param[in] beg индекс первого токена объекта.
+	  \param[in] name название поля.
+	  \return индекс токена значения, либо -1
+	*/
+	int find(int beg, const SJsonKey &name);
+	/// Количество элементов объекта/массива.
+	/*!
+	  \param[in] i индекс токена объекта/массива.
+	  \return количество полей/элементов
+	*/
+	int size(int i);
+	/// Получить значение токена.
+	/*!
+	  \param[in] i индекс токена значения.
+	  \param[in] kind тип значения.
+	  \param[out] value указатель на значение.
+	  \return true, если тип токена соответствует kind
+	*/
+	bool getValue(int i, SJsonField::EKind kind, void *value);
+	/// Получить первый токен объекта/массива.
+	/*!
+	  \param[in] i индекс токена объекта/массива.
+	  \param[in] type тип токена.
+	  \param[out] value индекс первого ключа/элемента.
+	  \return true, если токен нужного типа и не пустой
+	*/
+	bool getFirst(int i, EJsonType type, int &value);
+	/// Начало json текста токена (для строк - открывающая кавычка).
+	inline uint32_t spanStart(int i) { return mRootTokens[i].start - ((mRootTokens[i].type == JSON_STRING) ? 1 : 0); };
+	/// Конец json текста токена (для строк - за закрывающей кавычкой).
+	inline uint32_t spanEnd(int i) { return mRootTokens[i].start + mRootTokens[i].len + ((mRootTokens[i].type == JSON_STRING) ? 1 : 0); };
+
+	template <typename T>
+	friend class CJsonRange;
 
 public:
 	/// Конструктор класса.
@@ -43,11 +275,70 @@ public:
 	  \return 1 (индекс первого токена) в случае успеха, иначе ошибка
 	*/
 	int parse(const char *json);
+	/// Потоковый разбор без таблицы токенов.
+	/*!
+	  Память O(глубины вложенности), глубина ограничена CONFIG_JSON_MAX_DEPTH.
+	  \param[in] json Парсируемая строка.
+	  \param[in] len Длина строки.
+	  \param[in] handler Обработчик событий.
+	  \return true, если строка разобрана полностью
+	*/
+	static bool sax(const char *json, size_t len, CJsonHandler *handler);
+	/// Парсинг пакета команд.
+	/*!
+	  Пакет - json массив объектов команд, либо объекты команд подряд (NDJSON). Одиночный объект - пакет из одной команды.
+	  Массив команд должен быть единственным корневым элементом.
+	  \param[in] json Парсируемая строка.
+	  \return количество команд, либо -1 в случае ошибки
+	*/
+	int parseBatch(const char *json);
+	/// Выполнить команды пакета по порядку.
+	/*!
+	  \param[in] handler обработчик команды: получает индекс первого токена объекта команды,
+	  возвращает ответ без обрамления {} (например, CSpiffsSystem::command), либо "".
+	  \return json массив ответов в порядке команд, для ошибочной команды - {"error":"описание ошибки"}
+	*/
+	std::string runBatch(std::function<std::string(int beg)> handler);
+	/// Парсинг CBOR (RFC 8949).
+	/*!
+	  Доступ к полям через те же методы, что и для json. Байтовые строки возвращаются getString без преобразования.
+	  Строки неопределенной длины не поддерживаются.
+	  \param[in] data данные CBOR.
+	  \param[in] size размер данных.
+	  \return 1 (индекс первого токена) в случае успеха, иначе ошибка
+	*/
+	int parseCbor(const uint8_t *data, size_t size);
+	/// Разобраны данные CBOR.
+	/*!
+	  \return true, если последний разбор был parseCbor
+	*/
+	inline bool isCbor() { return mCbor; };
 	/// Строка Json.
 	/*!
-	  \return Строка Json
+	  \return Строка Json (для CBOR - двоичные данные)
 	*/
 	inline const char *getJson() { return mJson.c_str(); };
+	/// Перевод json в CBOR.
+	/*!
+	  \param[in] json строка json (например, ответ команды в обрамлении {}).
+	  \param[in] len длина строки.
+	  \param[out] cbor данные CBOR.
+	  \return true в случае успеха, false также для примитивов, не являющихся числами json
+	*/
+	static bool toCbor(const char *json, size_t len, std::string &cbor);
+	/// Строка в виде json (без кавычек): '"', '\\' и управляющие символы заменяются escape-последовательностями.
+	/*!
+	  \param[in] str строка.
+	  \return текст для вставки между кавычками
+	*/
+	static std::string escape(const std::string &str);
+	/// Раскодировать escape-последовательности строки json.
+	/*!
+	  \param[in] str текст строки без кавычек (например, из getString).
+	  \param[in] len длина текста.
+	  \return строка (\\uXXXX - в UTF-8)
+	*/
+	static std::string unescape(const char *str, size_t len);
 
 	/// Получить поле null.
 	/*!
@@ -55,7 +346,7 @@ public:
 	  \param[in] name название поля.
 	  \return true в случае успеха
 	*/
-	bool getField(int beg, const char *name);
+	bool getField(int beg, const SJsonKey &name);
 	/// Получить строковое поле.
 	/*!
 	  \param[in] beg индекс первого токена объекта.
@@ -63,7 +354,7 @@ public:
 	  \param[out] value значение поля.
 	  \return true в случае успеха
 	*/
-	bool getString(int beg, const char *name, std::string &value);
+	bool getString(int beg, const SJsonKey &name, std::string &value);
 	/// Получить поле int.
 	/*!
 	  \param[in] beg индекс первого токена объекта.
@@ -71,7 +362,7 @@ public:
 	  \param[out] value значение поля.
 	  \return true в случае успеха
 	*/
-	bool getInt(int beg, const char *name, int &value);
+	bool getInt(int beg, const SJsonKey &name, int &value);
 	/// Получить поле float.
 	/*!
 	  \param[in] beg индекс первого токена объекта.
@@ -79,7 +370,7 @@ public:
 	  \param[out] value значение поля.
 	  \return true в случае успеха
 	*/
-	bool getFloat(int beg, const char *name, float &value);
+	bool getFloat(int beg, const SJsonKey &name, float &value);
 	/// Получить логическое поле.
 	/*!
 	  \param[in] beg индекс первого токена объекта.
@@ -87,7 +378,7 @@ public:
 	  \param[out] value значение поля.
 	  \return true в случае успеха
 	*/
-	bool getBool(int beg, const char *name, bool &value);
+	bool getBool(int beg, const SJsonKey &name, bool &value);
 	/// Получить поле объекта.
 	/*!
 	  \param[in] beg индекс первого токена объекта.
@@ -95,7 +386,7 @@ public:
 	  \param[out] value значение поля.
 	  \return true в случае успеха
 	*/
-	bool getObject(int beg, const char *name, int &value);
+	bool getObject(int beg, const SJsonKey &name, int &value);
 
 	/// Получить массив int.
 	/*!
@@ -107,7 +398,180 @@ public:
 
 	  После использования уничтожить данные delete[] data.
 	*/
-	bool getArrayInt(int beg, const char *name, int *&data, int &size);
+	bool getArrayInt(int beg, const SJsonKey &name, int *&data, int &size);
+
+	/// Получить несколько полей за один проход по объекту.
+	/*!
+	  \param[in] beg индекс первого токена объекта.
+	  \param[in] fields описания полей (не больше 32).
+	  \return маска найденных полей (бит i соответствует fields[i])
+
+	  Пример: if ((cmd->getMany(t2, {{"rd", &fname}, {"offset", &offset}, {"size", &size}}) & 0x01) != 0)
+	*/
+	uint32_t getMany(int beg, std::initializer_list<SJsonField> fields);
+
+	/// Получить поле массива.
+	/*!
+	  \param[in] beg индекс первого токена объекта.
+	  \param[in] name название поля.
+	  \param[out] value индекс первого элемента массива.
+	  \return true в случае успеха (массив не пустой)
+	*/
+	bool getArray(int beg, const SJsonKey &name, int &value);
+
+	/// Поля объекта.
+	/*!
+	  \param[in] beg индекс первого токена объекта.
+	  \return диапазон пар (индекс ключа, индекс значения)
+
+	  Пример: for (auto [key, val] : cmd->members(t2))
+	*/
+	CJsonRange<std::pair<int, int>> members(int beg);
+	/// Элементы массива.
+	/*!
+	  \param[in] beg индекс первого элемента массива.
+	  \return диапазон индексов элементов
+
+	  Пример: if (cmd->getArray(t2, "rm", t3)) for (int v : cmd->elements(t3))
+	*/
+	CJsonRange<int> elements(int beg);
+
+	/// Получить строку по индексу токена.
+	/*!
+	  \param[in] i индекс токена (ключа, значения или элемента массива).
+	  \param[out] value значение.
+	  \return true в случае успеха
+	*/
+	bool getString(int i, std::string &value) { return getValue(i, SJsonField::STRING, &value); };
+	/// Получить int по индексу токена.
+	/*!
+	  \param[in] i индекс токена.
+	  \param[out] value значение.
+	  \return true в случае успеха
+	*/
+	bool getInt(int i, int &value) { return getValue(i, SJsonField::INT, &value); };
+	/// Получить float по индексу токена.
+	/*!
+	  \param[in] i индекс токена.
+	  \param[out] value значение.
+	  \return true в случае успеха
+	*/
+	bool getFloat(int i, float &value) { return getValue(i, SJsonField::FLOAT, &value); };
+	/// Получить логическое значение по индексу токена.
+	/*!
+	  \param[in] i индекс токена.
+	  \param[out] value значение.
+	  \return true в случае успеха
+	*/
+	bool getBool(int i, bool &value) { return getValue(i, SJsonField::BOOL, &value); };
+	/// Проверить значение null по индексу токена.
+	/*!
+	  \param[in] i индекс токена.
+	  \return true, если значение null
+	*/
+	bool isNull(int i) { return getValue(i, SJsonField::NONE, nullptr); };
+	/// Получить объект по индексу токена.
+	/*!
+	  \param[in] i индекс токена.
+	  \param[out] value индекс первого ключа объекта.
+	  \return true в случае успеха (объект не пустой)
+	*/
+	bool getObject(int i, int &value) { return getFirst(i, JSON_OBJECT, value); };
+	/// Получить массив по индексу токена.
+	/*!
+	  \param[in] i индекс токена.
+	  \param[out] value индекс первого элемента массива.
+	  \return true в случае успеха (массив не пустой)
+	*/
+	bool getArray(int i, int &value) { return getFirst(i, JSON_ARRAY, value); };
+
+	/// Получить json текст значения по индексу токена.
+	/*!
+	  \param[in] i индекс токена.
+	  \param[out] value json текст (строки в кавычках).
+	  \return true в случае успеха (не для CBOR)
+	*/
+	bool getText(int i, std::string &value);
+	/// Получить json текст значения поля.
+	/*!
+	  \param[in] beg индекс первого токена объекта.
+	  \param[in] name название поля.
+	  \param[out] value json текст (строки в кавычках).
+	  \return true в случае успеха (не для CBOR)
+	*/
+	bool getText(int beg, const SJsonKey &name, std::string &value);
+
+	/// Найти значение по пути JSON Pointer (RFC 6901).
+	/*!
+	  Сегменты пути сравниваются с раскодированными ключами объектов.
+	  \param[in] path путь, например "/wifi/ssid" или "/list/0" ("" - корень).
+	  \return индекс токена значения, либо -1
+	*/
+	int findPath(const std::string &path);
+	/// Применить операцию JSON Patch (RFC 6902) к разобранному документу.
+	/*!
+	  \param[in] op операция: "add", "remove", "replace" или "test".
+	  \param[in] path путь JSON Pointer.
+	  \param[in] value json текст ровно одного значения (для add, replace и test).
+	  test сравнивает значения, а не текст: порядок полей объекта, escape-последовательности строк
+	  и запись чисел (1 и 1.0) не важны.
+	  \param[out] result json текст документа после операции.
+	  \return "" в случае успеха, иначе описание ошибки
+	*/
+	std::string patch(const std::string &op, const std::string &path, const std::string &value, std::string &result);
+	/// Заменить несколько значений разобранного документа за один проход.
+	/*!
+	  \param[in] values индекс токена значения (строка, число, true, false, null) и json текст нового значения,
+	  по возрастанию индекса.
+	  \param[out] result json текст документа после замены.
+	  \return true в случае успеха
+	*/
+	bool replace(const std::vector<std::pair<int, std::string>> &values, std::string &result);
+};
+
+/// Диапазон ключей объекта или элементов массива для range-based for.
+/*!
+  Не выделяет память, вложенные объекты и массивы пропускаются по ссылкам next.
+  \tparam T std::pair<int, int> (ключ, значение) для объекта, либо int для массива.
+*/
+template <typename T>
+class CJsonRange
+{
+protected:
+	CJsonParser *mParser; ///< Парсер.
+	int mFirst;			  ///< Индекс первого ключа/элемента, либо -1.
+
+public:
+	/// Итератор диапазона.
+	class iterator
+	{
+	protected:
+		CJsonParser *mParser; ///< Парсер.
+		int mIndex;			  ///< Индекс текущего ключа/элемента, либо -1.
+
+	public:
+		iterator(CJsonParser *parser, int index) : mParser(parser), mIndex(index) {};
+
+		T operator*() const
+		{
+			if constexpr (std::is_same<T, int>::value)
+				return mIndex;
+			else
+				return T(mIndex, mIndex + 1);
+		};
+		iterator &operator++()
+		{
+			mIndex = mParser->next(mIndex);
+			return *this;
+		};
+		bool operator!=(const iterator &other) const { return mIndex != other.mIndex; };
+		bool operator==(const iterator &other) const { return mIndex == other.mIndex; };
+	};
+
+	CJsonRange(CJsonParser *parser, int first) : mParser(parser), mFirst(first) {};
+
+	iterator begin() const { return iterator(mParser, mFirst); };
+	iterator end() const { return iterator(mParser, -1); };
 };
 
 #endif // CJSONPARSER_H
@@ -0,0 +1,96 @@
+/*!
+	\file
+	\brief Класс хранилища ключ-значение в SPIFFS.
+	\authors Близнец Р.А. (r.bliznets@gmail.com)
+	\version 0.1.0.0
+	\date 17.10.2026
+*/
+
+#pragma once
+
+#include "sdkconfig.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <mutex>
+
+#define KV_MAGIC (0x5a)		 ///< Первый байт записи.
+#define KV_HEADER_SIZE (8)	 ///< Заголовок записи: KV_MAGIC, размер ключа(1), размер значения(2), CRC32 ключа и значения(4).
+#define KV_DELETED (0xffff) ///< Размер значения записи удаления.
+
+/// Хранилище ключ-значение в одном файле.
+/*!
+  Записи только дописываются в конец файла, индекс (хэш ключа, смещение записи) хранится в RAM
+  и строится при загрузке. Устаревшие записи удаляются при уплотнении файла.
+*/
+class CKeyValue
+{
+protected:
+	std::string mFileName;								///< Имя файла.
+	std::vector<std::pair<uint32_t, uint32_t>> mIndex; ///< Хэш ключа и смещение записи, по возрастанию хэша.
+	uint32_t mSize = 0;									///< Размер файла.
+	uint32_t mGarbage = 0;								///< Размер устаревших записей.
+	bool mLoaded = false;
+	std::mutex mMutex;
+
+	/// Хэш ключа (FNV-1a).
+	static uint32_t hash(const std::string &key);
+	/// Найти запись ключа.
+	/*!
+	  \param[in] key ключ.
+	  \param[out] value значение (если не nullptr).
+	  \param[out] size размер записи.
+	  \return индекс в mIndex, либо -1
+	*/
+	int find(const std::string &key, std::string *value, uint32_t &size);
+	/// Дописать запись в файл.
+	bool append(const std::string &key, const std::string *value);
+	/// Уплотнить файл, если устаревших записей больше, чем действующих.
+	void check();
+	/// Уплотнить файл (вызывается под mMutex).
+	bool compactFile();
+
+public:
+	/// Конструктор.
+	/*!
+	  \param[in] fname имя файла в SPIFFS.
+	*/
+	CKeyValue(const std::string &fname) : mFileName(fname) {};
+
+	/// Построить индекс по файлу.
+	/*!
+	  Повреждённый конец файла (прерванная запись) удаляется уплотнением.
+	  \return true в случае успеха
+	*/
+	bool load();
+	/// Получить значение.
+	/*!
+	  \param[in] key ключ.
+	  \param[out] value значение.
+	  \return true если ключ найден
+	*/
+	bool get(const std::string &key, std::string &value);
+	/// Записать значение.
+	/*!
+	  \param[in] key ключ (до 255 байт).
+	  \param[in] value значение (до 65534 байт).
+	  \return true в случае успеха
+	*/
+	bool put(const std::string &key, const std::string &value);
+	/// Удалить ключ.
+	/*!
+	  \param[in] key ключ.
+	  \return true если ключ был удалён
+	*/
+	bool del(const std::string &key);
+	/// Уплотнить файл.
+	bool compact();
+
+	/// Количество ключей.
+	inline size_t size() { return mIndex.size(); };
+	/// Размер файла.
+	inline uint32_t fileSize() { return mSize; };
+	/// Размер устаревших записей.
+	inline uint32_t garbage() { return mGarbage; };
+};
@@ -0,0 +1,106 @@
+/*!
+	\file
+	\brief Класс журнала в SPIFFS с ротацией файлов.
+	\authors Близнец Р.А. (r.bliznets@gmail.com)
+	\version 0.1.0.0
+	\date 17.10.2026
+*/
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "CJsonParser.h"
+#include "CBufferSystem.h"
+#include <string>
+#include <mutex>
+
+#define LOG_MAGIC (0xa5)	  ///< Первый байт записи.
+#define LOG_HEADER_SIZE (11) ///< Заголовок записи: LOG_MAGIC, размер(2), номер(4), CRC32 номера и данных(4).
+
+/// Журнал из нескольких файлов ограниченного размера.
+/*!
+  Записи накапливаются в RAM и дописываются в текущий файл <имя>.<номер_файла> целиком.
+  Когда файл заполнен, создаётся следующий, самый старый файл удаляется.
+  Каждая запись имеет сквозной номер и CRC32, повреждённые записи пропускаются при чтении.
+*/
+class CRotatingLog
+{
+protected:
+	std::string mName;			 ///< Префикс имён файлов.
+	uint16_t mFiles;			 ///< Количество файлов.
+	uint32_t mMaxSize;			 ///< Максимальный размер файла в байтах.
+	uint8_t *mBuffer = nullptr; ///< Буфер записей в RAM.
+	uint32_t mBufSize;			 ///< Размер буфера в байтах.
+	uint32_t mUsed = 0;			 ///< Занято в буфере.
+	uint32_t mFirstFile = 0;	 ///< Номер самого старого файла.
+	uint32_t mLastFile = 0;		 ///< Номер текущего файла.
+	uint32_t mFileSize = 0;		 ///< Размер текущего файла.
+	uint32_t mNext = 0;			 ///< Номер следующей записи.
+	uint32_t mWritten = 0;		 ///< Записано записей после старта.
+	uint32_t mDropped = 0;		 ///< Отброшено записей (слишком большие).
+	uint32_t mFlushes = 0;		 ///< Количество записей буфера в файл.
+	uint32_t mFlushTime = 0;	 ///< Суммарное время записи буфера в файл, мс.
+	std::mutex mMutex;
+
+	/// Имя файла по номеру.
+	inline std::string fileName(uint32_t n) { return mName + "." + std::to_string(n); };
+	/// Записать буфер в файл (вызывается под mMutex).
+	bool flushBuffer();
+	/// Разобрать записи файла.
+	/*!
+	  Файл читается блоками по SPIFFS_COPY_CHUNK байт, в памяти находится не больше блока и одной записи.
+	  \param[in] fname имя файла.
+	  \param[in] from номер первой нужной записи.
+	  \param[in] to номер последней нужной записи.
+	  \param[out] res найденные записи вместе с заголовками.
+	  \param[out] last номер последней правильной записи (если found).
+	  \param[out] found в файле есть правильная запись.
+	  \return количество найденных записей
+	*/
+	uint32_t scan(const std::string &fname, uint32_t from, uint32_t to, std::string *res, uint32_t &last, bool &found);
+
+public:
+	/// Конструктор.
+	/*!
+	  \param[in] name префикс имён файлов.
+	  \param[in] files количество файлов.
+	  \param[in] size максимальный размер файла в байтах.
+	  \param[in] buffer размер буфера в RAM в байтах.
+	*/
+	CRotatingLog(const std::string &name, uint16_t files = CONFIG_LOG_FILES, uint32_t size = CONFIG_LOG_FILE_SIZE * 1024, uint32_t buffer = CONFIG_LOG_BUFFER_SIZE);
+	/// Деструктор, записывает буфер в файл.
+	~CRotatingLog();
+
+	/// Найти файлы журнала и номер следующей записи.
+	/*!
+	  \return true в случае успеха
+	*/
+	bool init();
+	/// Добавить запись.
+	/*!
+	  \param[in] data данные.
+	  \param[in] size размер данных в байтах.
+	  \return true в случае успеха
+	*/
+	bool write(const uint8_t *data, uint16_t size);
+	bool write(const std::string &str) { return write((const uint8_t *)str.data(), str.size()); };
+	/// Записать буфер в файл.
+	bool flush();
+	/// Прочитать записи.
+	/*!
+	  \param[in] from номер первой записи.
+	  \param[in] to номер последней записи.
+	  \param[out] data записи вместе с заголовками.
+	  \return количество записей
+	*/
+	uint32_t read(uint32_t from, uint32_t to, std::string &data);
+
+	/// Обработка команды.
+	/*!
+	  \param[in] cmd json объектом log в корне.
+	  \param[in] buf буфер для передачи записей по 2-му каналу.
+	  \param[in] beg индекс первого токена объекта команды (для пакета команд).
+	  \return json строка с ответом (без обрамления в начале и конце {}), либо "".
+	*/
+	std::string command(CJsonParser *cmd, CBufferSystem *buf, int beg = 1);
+};
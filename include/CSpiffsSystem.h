@@ -10,10 +10,50 @@
 
 #include "sdkconfig.h"
 #include "CJsonParser.h"
+#include "CKeyValue.h"
+#include "CFsBackend.h"
+#include <vector>
+#include <mutex>
+
+#define SPIFFS_COPY_CHUNK (4096) ///< Размер блока копирования файлов и чтения для контрольных сумм.
+#define SPIFFS_SUM_CACHE (16)	  ///< Количество запоминаемых контрольных сумм.
+#define SPIFFS_SUM_CRC32 (0x01)	  ///< Контрольная сумма CRC32.
+#define SPIFFS_SUM_SHA256 (0x02)  ///< Контрольная сумма SHA-256.
+#define SPIFFS_BLOCK_MIN (64)	  ///< Минимальный размер блока команд "sums" и "delta".
+#define SPIFFS_BLOCK_MAX (16384)  ///< Максимальный размер блока команд "sums" и "delta".
 
 /// Статические методы для работы с файловой системой.
+/*!
+  Файловая система (SPIFFS, LittleFS, FAT или каталог хоста) выбирается в sdkconfig, см. CFsBackend.
+*/
 class CSpiffsSystem
 {
+protected:
+	static CFsBackend *mFs; ///< Смонтированная файловая система.
+
+	/// Контрольная сумма части файла.
+	struct SDigest
+	{
+		std::string name;  ///< Имя файла.
+		uint32_t offset;   ///< Смещение.
+		uint32_t size;	   ///< Размер.
+		uint32_t fileSize; ///< Размер файла при вычислении.
+		uint8_t alg;	   ///< Вычисленные суммы (SPIFFS_SUM_*).
+		uint32_t crc;	   ///< CRC32.
+		uint8_t sha[32];   ///< SHA-256.
+	};
+	static std::vector<SDigest> mDigests; ///< Вычисленные контрольные суммы, самая старая первая.
+	static std::mutex mDigestMutex;
+
+	/// Тест скорости файловой системы.
+	/*!
+	  Запись, чтение, запись в случайные места, список и удаление файлов bench.<номер>.
+	  \param[in] files количество файлов.
+	  \param[in] size размер файла в байтах.
+	  \return json поля с временем операций в мс
+	*/
+	static std::string bench(int files, int size);
+
 public:
 	/// Инициализация файловой системы.
 	/*!
@@ -22,13 +62,85 @@ public:
 	static void init(bool check = false);
 	/// Закрытие файловой системы.
 	static void free();
+	/// Смонтированная файловая система, либо nullptr.
+	static inline CFsBackend *fs() { return mFs; };
+	/// Путь монтирования файловой системы.
+	static inline const char *base() { return CONFIG_FS_BASE_PATH; };
+	/// Полный путь файла.
+	/*!
+	  \param[in] fname имя файла.
+	  \return путь для fopen
+	*/
+	static inline std::string path(const std::string &fname = "") { return std::string(CONFIG_FS_BASE_PATH "/") + fname; };
 	/// Проверка на незавершенные транзакции и их очистка.
 	static bool endTransaction();
 
+	/// Прочитать файл целиком.
+	/*!
+	  \param[in] fname имя файла.
+	  \param[out] data содержимое файла.
+	  \return true в случае успеха
+	*/
+	static bool readFile(const std::string &fname, std::string &data);
+	/// Записать файл целиком через транзакцию (<имя_файла>$ -> <имя_файла>! -> <имя_файла>).
+	/*!
+	  \param[in] fname имя файла.
+	  \param[in] data содержимое файла.
+	  \return true в случае успеха
+	*/
+	static bool writeFile(const std::string &fname, const std::string &data);
+	/// Завершить транзакцию записи файла (<имя_файла>$ -> <имя_файла>! -> <имя_файла>).
+	/*!
+	  \param[in] fname имя файла (без '$').
+	  \return true в случае успеха
+	*/
+	static bool commitFile(const std::string &fname);
+	/// Копировать файлы в один файл через транзакцию записи файла.
+	/*!
+	  Данные копируются блоками по SPIFFS_COPY_CHUNK байт.
+	  \param[in] src имена исходных файлов (может быть и fname, тогда копируется его старое содержимое).
+	  \param[in] fname имя нового файла.
+	  \param[out] size размер нового файла.
+	  \param[in] skip смещение пропускаемых данных (в объединённых исходных файлах).
+	  \param[in] skipSize размер пропускаемых данных.
+	  \return "" в случае успеха, иначе описание ошибки
+	*/
+	static std::string copyFile(const std::vector<std::string> &src, const std::string &fname, uint32_t &size, uint32_t skip = 0, uint32_t skipSize = 0);
+	/// Контрольная сумма файла.
+	/*!
+	  Файл читается блоками по SPIFFS_COPY_CHUNK байт, выровненными по смещению в файле.
+	  Результат запоминается до изменения файла (см. invalidate).
+	  \param[in] fname имя файла.
+	  \param[in] offset смещение.
+	  \param[in,out] size размер (0 - до конца файла), уменьшается до конца файла.
+	  \param[in] alg контрольные суммы (SPIFFS_SUM_*).
+	  \param[out] crc CRC32.
+	  \param[out] sha SHA-256.
+	  \param[out] cached сумма взята из запомненных.
+	  \return true в случае успеха
+	*/
+	static bool digest(const std::string &fname, uint32_t offset, uint32_t &size, uint8_t alg, uint32_t &crc, uint8_t sha[32], bool &cached);
+	/// Забыть контрольные суммы файла (вызывается при изменении файла).
+	/*!
+	  \param[in] fname имя файла.
+	*/
+	static void invalidate(const std::string &fname);
+	/// Контрольные суммы блока для обновления файла по разнице (rsync).
+	/*!
+	  \param[in] data данные блока.
+	  \param[in] size размер блока.
+	  \param[out] strong первые 8 байт SHA-256 блока.
+	  \return слабая кольцевая контрольная сумма (rsync)
+	*/
+	static uint32_t blockSum(const uint8_t *data, uint32_t size, uint8_t strong[8]);
+	/// Хранилище ключ-значение (файл kv), индекс строится в init().
+	static CKeyValue &kv();
+
 	/// Обработка команды.
 	/*!
 	  \param[in] cmd json объектом spiffs в корне.
+	  \param[in] beg индекс первого токена объекта команды (для пакета команд).
 	  \return json строка с ответом (без обрамления в начале и конце {}), либо "".
 	*/
-	static std::string command(CJsonParser *cmd);
+	static std::string command(CJsonParser *cmd, int beg = 1);
 };